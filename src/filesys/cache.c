@@ -1,28 +1,116 @@
 /* buffer cache implementation */
-/* buffer cache with 64 lines is defined as list of cache_line structures */
+/* buffer cache is defined as array of cache_line structures,
+   whose blocks are in contiguous pages */
 
 #include "filesys/cache.h"
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
 
 /////////* added to implement read-ahead */////////
-struct list read_ahead_queue;
+/* bounded ring of sectors to read-ahead. requests are dropped
+   when the ring is full, or when the sector is queued already. */
+#define READ_AHEAD_QUEUE_SIZE 64
+static disk_sector_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static int read_ahead_head;         /* index of the oldest request */
+static int read_ahead_cnt;          /* number of queued requests */
 struct lock read_ahead_lock;
-struct read_ahead_elem{
+struct condition not_empty;
+
+/* number of cache lines, set by -bc option */
+size_t buffer_cache_capacity = BUFFER_CACHE_DEFAULT_CAPACITY;
+
+/* replacement policy, set by -bcp option */
+enum cache_policy buffer_cache_policy = CACHE_POLICY_2Q;
+
+/* cache lines, and their blocks that are CACHE_BLOCKS_PER_PAGE per page */
+static struct cache_line *buffer_cache;
+static uint8_t *buffer_cache_blocks;
+
+/* maximum number of sectors written by write_behind_all() in one transfer */
+#define WRITE_BEHIND_MAX_RUN 64
+
+/* write_behind_all() and cache_flush() copy dirty lines here and write
+   them to disk without buffer_cache_lock. write_behind_lock serializes
+   their callers. */
+static uint8_t *write_behind_bounce;
+static struct lock write_behind_lock;
+
+/* index of buffer cache lines keyed by sector_idx,
+   so that find_cache_line() does not scan whole buffer_cache */
+static struct hash buffer_cache_index;
+
+/* statistics, protected by buffer_cache_lock */
+static struct cache_stat stat;
+
+/* signaled when pin_cnt of a cache line drops to 0 */
+static struct condition cache_line_unpinned;
+
+/////////* state of replacement policies, kept between evictions */////////
+/* clock: index of the line to look at first in next eviction */
+static int clock_hand;
+
+/* 2Q: a1in and am hold cache lines. a1out remembers sectors recently
+   evicted from a1in, so that a sector referenced again soon after goes to am.
+   a sector read only once, as in a sequential read of a big file, never
+   reaches am and cannot push hot lines out of it. */
+struct ghost_entry{
   disk_sector_t sector;
-  struct list_elem elem;
+  struct hash_elem hash_elem;
+  struct list_elem elem;            /* element of a1out or ghost_free */
 };
-struct condition not_empty;
+static struct list a1in, am, a1out;
+static struct list ghost_free;
+static struct hash a1out_index;
+static size_t a1in_size, a1in_max;
+
+static void policy_init(void);
+static void policy_touch(struct cache_line *);
+static void policy_insert(struct cache_line *);
+static void policy_remove(struct cache_line *);
+static struct cache_line * policy_select_victim(void);
+static bool idle(const struct cache_line *);
 
 static thread_func read_ahead_get NO_RETURN;
 static thread_func periodical_write_back NO_RETURN;
 
+static hash_hash_func cache_line_hash;
+static hash_less_func cache_line_less;
+
 /* initiation of buffer cache */
 void init_buffer_cache(){
-  list_init(&buffer_cache);
+  size_t i;
+
+  if(buffer_cache_capacity < BUFFER_CACHE_MIN_CAPACITY)
+    buffer_cache_capacity = BUFFER_CACHE_MIN_CAPACITY;
+  buffer_cache = calloc(buffer_cache_capacity, sizeof *buffer_cache);
+  if(!buffer_cache)
+    PANIC("no space for buffer cache");
+  buffer_cache_blocks = palloc_get_multiple(PAL_ASSERT,
+                          DIV_ROUND_UP(buffer_cache_capacity, CACHE_BLOCKS_PER_PAGE));
+  for(i = 0; i < buffer_cache_capacity; i++){
+    buffer_cache[i].block = buffer_cache_blocks + i * DISK_SECTOR_SIZE;
+    cond_init(&buffer_cache[i].io_done);
+  }
+
+  write_behind_bounce = palloc_get_multiple(PAL_ASSERT,
+                          DIV_ROUND_UP(WRITE_BEHIND_MAX_RUN, CACHE_BLOCKS_PER_PAGE));
+  lock_init(&write_behind_lock);
+
+  hash_init(&buffer_cache_index, cache_line_hash, cache_line_less, NULL);
+  policy_init();
   lock_init(&buffer_cache_lock);
-  list_init(&read_ahead_queue);
+  cond_init(&cache_line_unpinned);
+  read_ahead_head = read_ahead_cnt = 0;
   lock_init(&read_ahead_lock);
   cond_init(&not_empty);
   buffer_cache_size = 0;
@@ -32,152 +120,684 @@ void init_buffer_cache(){
   thread_create("read-aheader", PRI_DEFAULT, read_ahead_get, NULL);
 }
 
-static void periodical_write_back(void *unused){
+/* set buffer_cache_policy by its name. returns false if NAME is unknown */
+bool set_buffer_cache_policy(const char *name){
+  if(!strcmp(name, "clock"))
+    buffer_cache_policy = CACHE_POLICY_CLOCK;
+  else if(!strcmp(name, "2q"))
+    buffer_cache_policy = CACHE_POLICY_2Q;
+  else
+    return false;
+  return true;
+}
+
+static void periodical_write_back(void *unused UNUSED){
   while(1){
     timer_sleep(500);       /* '500 ticks' is arbitrary period */
+    inode_allocate_delayed_all();
+    free_map_flush();
     write_behind_all(false);
   }
 }
 
 /* inode_read_at() and inode_write_at() call this function. 
    to get cache line of given sector, call find_cache_line() first.
-   if return value is null, read from disk and add by calling add_cache_line(). */
-struct cache_line * get_cache_line(disk_sector_t sector_idx, int dirty){
+   if return value is null, read from disk and add by calling add_cache_line().
+   returned line is valid and pinned, so it is not evicted while the caller
+   copies from or to its block. caller must call release_cache_line() after that.
+   MODE is one of CACHE_READ, CACHE_WRITE and CACHE_OVERWRITE. with CACHE_OVERWRITE
+   the caller promises to overwrite the whole block, so a missing sector is not read
+   from disk. such a line is handed out still LOADING, and becomes valid when the
+   caller releases it.
+   with CACHE_JOURNAL or'ed to a write mode, the sector joins the journal
+   transaction of the current thread, and the line is held until it commits. */
+struct cache_line * get_cache_line(disk_sector_t sector_idx, int mode){
+  struct cache_line *cl;
+  bool journal = (mode & CACHE_JOURNAL) != 0;
+
+  mode &= ~CACHE_JOURNAL;
   lock_acquire(&buffer_cache_lock);
-  struct cache_line *cl = find_cache_line(sector_idx);
-  if(cl){
-    //cl->accessing_processes ++;
-    if(dirty){/* write */
-      cl->dirty = 1;
+  while(1){
+    cl = find_cache_line(sector_idx);
+    if(cl){
+      stat.hits ++;
+      if(cl->read_ahead){
+        stat.read_ahead_hits ++;
+        cl->read_ahead = 0;
+      }
+      cl->pin_cnt ++;
+      /* never hand out a line which is still being filled, nor one to
+         write while its block is on the way to disk. what reaches disk
+         must be the data written back, not part of a later, maybe
+         uncommitted, change */
+      while(cl->state == CL_LOADING
+            || (mode != CACHE_READ && cl->state == CL_WRITING))
+        cond_wait(&cl->io_done, &buffer_cache_lock);
+      break;
+    }
+    /* add_cache_line() returns null when it had to release buffer_cache_lock
+       before the line was added. someone else may have added the sector meanwhile,
+       so look it up again. */
+    cl = add_cache_line(sector_idx, mode != CACHE_OVERWRITE);
+    if(cl){
+      stat.misses ++;
+      break;
     }
   }
-  else{
-    cl = add_cache_line(sector_idx);
-    cl->dirty = dirty;
+  if(mode != CACHE_READ){/* write */
+    cl->dirty = 1;
+    cl->write_gen ++;
   }
-  cl->accessed = 1;
+  policy_touch(cl);
   lock_release(&buffer_cache_lock);
+
+  /* the line is pinned, so it is not written back before it is held */
+  if(journal && journal_add(sector_idx)){
+    lock_acquire(&buffer_cache_lock);
+    cl->held = 1;
+    lock_release(&buffer_cache_lock);
+  }
   return cl;
 }
 
+/* end of accessing the cache line got by get_cache_line() */
+void release_cache_line(struct cache_line *cl){
+  lock_acquire(&buffer_cache_lock);
+  ASSERT(cl->pin_cnt > 0);
+  /* the caller has just filled the block with CACHE_OVERWRITE */
+  if(cl->state == CL_LOADING){
+    cl->state = CL_VALID;
+    cond_broadcast(&cl->io_done, &buffer_cache_lock);
+  }
+  if(--cl->pin_cnt == 0)
+    cond_broadcast(&cache_line_unpinned, &buffer_cache_lock);
+  lock_release(&buffer_cache_lock);
+}
+
+/* copy SIZE bytes at OFS of SECTOR to BUFFER through the buffer cache */
+void cache_read(disk_sector_t sector, void *buffer, int ofs, int size){
+  struct cache_line *cl;
+  ASSERT(ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+  cl = get_cache_line(sector, CACHE_READ);
+  memcpy(buffer, cl->block + ofs, size);
+  release_cache_line(cl);
+}
+
+/* copy SIZE bytes of BUFFER to OFS of SECTOR through the buffer cache, with
+   FLAGS or'ed to the mode. if BUFFER is null, zeros are written instead. */
+static void write_block(disk_sector_t sector, const void *buffer, int ofs, int size,
+                        int flags){
+  struct cache_line *cl;
+  ASSERT(ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+  cl = get_cache_line(sector, (size == DISK_SECTOR_SIZE ? CACHE_OVERWRITE : CACHE_WRITE)
+                              | flags);
+  if(buffer != NULL)
+    memcpy(cl->block + ofs, buffer, size);
+  else
+    memset(cl->block + ofs, 0, size);
+  release_cache_line(cl);
+}
+
+/* copy SIZE bytes of BUFFER to OFS of SECTOR through the buffer cache.
+   if BUFFER is null, zeros are written instead. */
+void cache_write(disk_sector_t sector, const void *buffer, int ofs, int size){
+  write_block(sector, buffer, ofs, size, 0);
+}
+
+/* same as cache_write(), for a metadata sector, which joins the journal
+   transaction of the current thread */
+void cache_write_journal(disk_sector_t sector, const void *buffer, int ofs, int size){
+  write_block(sector, buffer, ofs, size, CACHE_JOURNAL);
+}
+
+/* let the line of SECTOR be written back, as its journal transaction
+   has committed */
+void cache_unhold(disk_sector_t sector){
+  struct cache_line *cl;
+
+  lock_acquire(&buffer_cache_lock);
+  cl = find_cache_line(sector);
+  if(cl)
+    cl->held = 0;
+  lock_release(&buffer_cache_lock);
+}
+
+/* write SECTOR to disk now if its line is dirty, for a journal checkpoint.
+   the line is written even if pinned, as its user is not in the middle of
+   a journal transaction, but then it stays dirty. the block is copied
+   into the bounce buffer first, so a user writing to it meanwhile cannot
+   tear what reaches disk. a line not cached or still loading has its
+   data on disk already. */
+void cache_flush(disk_sector_t sector){
+  struct cache_line *cl;
+  unsigned gen;
+  bool busy;
+
+  lock_acquire(&write_behind_lock);
+  lock_acquire(&buffer_cache_lock);
+  while((cl = find_cache_line(sector)) && cl->state == CL_WRITING)
+    cond_wait(&cl->io_done, &buffer_cache_lock);
+  if(cl && cl->state == CL_VALID && cl->dirty){
+    ASSERT(!cl->held);
+    busy = cl->pin_cnt > 0;
+    cl->pin_cnt ++;
+    gen = cl->write_gen;
+    memcpy(write_behind_bounce, cl->block, DISK_SECTOR_SIZE);
+    lock_release(&buffer_cache_lock);
+    disk_write(filesys_disk, sector, write_behind_bounce);
+    lock_acquire(&buffer_cache_lock);
+    stat.write_backs ++;
+    if(!busy && cl->write_gen == gen)
+      cl->dirty = 0;
+    if(--cl->pin_cnt == 0)
+      cond_broadcast(&cache_line_unpinned, &buffer_cache_lock);
+  }
+  lock_release(&buffer_cache_lock);
+  lock_release(&write_behind_lock);
+}
+
+/* give the block of delayed sector FROM to real sector TO, which has just
+   been allocated. waits until nobody uses either line. if TO is cached
+   already, as a sector freed and allocated again, FROM's data is copied
+   into that line instead. the line of TO is dirty afterwards.
+   returns false if FROM is not cached, that is, it is all zeros. */
+bool cache_rename(disk_sector_t from, disk_sector_t to){
+  struct cache_line *cl, *old;
+
+  ASSERT(cache_delayed(from) && !cache_delayed(to));
+  lock_acquire(&buffer_cache_lock);
+  while(1){
+    cl = find_cache_line(from);
+    if(!cl){
+      lock_release(&buffer_cache_lock);
+      return false;
+    }
+    old = find_cache_line(to);
+    if(idle(cl) && (!old || idle(old)))
+      break;
+    cond_wait(&cache_line_unpinned, &buffer_cache_lock);
+  }
+
+  if(!old){
+    hash_delete(&buffer_cache_index, &cl->hash_elem);
+    cl->sector_idx = to;
+    hash_insert(&buffer_cache_index, &cl->hash_elem);
+  }
+  else{
+    memcpy(old->block, cl->block, DISK_SECTOR_SIZE);
+    /* nobody can reach FROM any more. let it be evicted */
+    cl->dirty = 0;
+    cl = old;
+  }
+  cl->dirty = 1;
+  cl->write_gen ++;
+  lock_release(&buffer_cache_lock);
+  return true;
+}
+
+/* drop the data of delayed SECTOR, whose file has been removed.
+   it is not written anywhere, and the line can be evicted from now on. */
+void cache_discard(disk_sector_t sector){
+  struct cache_line *cl;
+
+  ASSERT(cache_delayed(sector));
+  lock_acquire(&buffer_cache_lock);
+  while((cl = find_cache_line(sector)) && !idle(cl))
+    cond_wait(&cache_line_unpinned, &buffer_cache_lock);
+  if(cl)
+    cl->dirty = 0;
+  lock_release(&buffer_cache_lock);
+}
+
+/* hash function for buffer_cache_index */
+static unsigned cache_line_hash(const struct hash_elem *e, void *aux UNUSED){
+  const struct cache_line *cl = hash_entry(e, struct cache_line, hash_elem);
+  return hash_int((int) cl->sector_idx);
+}
+
+/* returns true if cache line a precedes cache line b */
+static bool cache_line_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+  const struct cache_line *a = hash_entry(a_, struct cache_line, hash_elem);
+  const struct cache_line *b = hash_entry(b_, struct cache_line, hash_elem);
+  return a->sector_idx < b->sector_idx;
+}
+
 /* find cache line with given sector and return it.
    if it does not exist, return null. */
 struct cache_line * find_cache_line(disk_sector_t sector_idx){
-  struct cache_line *cl;
-  struct list_elem *elem;
-  for(elem = list_begin(&buffer_cache); elem != list_end(&buffer_cache); elem = list_next(elem)){
-    cl = list_entry(elem, struct cache_line, elem);
-    if(sector_idx == cl->sector_idx)
-      return cl;
-  }
-  return NULL;
+  struct cache_line key;
+  struct hash_elem *e;
+  key.sector_idx = sector_idx;
+  e = hash_find(&buffer_cache_index, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct cache_line, hash_elem) : NULL;
 }
 
 /* add new cache line by reading from disk.
-   if cache is already full, add after eviction by calling evict_cache_line(). */
-struct cache_line * add_cache_line(disk_sector_t sector_idx){
+   if cache is already full, add after eviction by calling evict_cache_line().
+   must be called with buffer_cache_lock held. the line is indexed in LOADING state
+   before the lock is released for disk_read(), so that other threads looking for
+   the same sector wait for it instead of reading it again.
+   if READ is false, the line is left LOADING without reading, for the caller to fill.
+   returns the line pinned, or null if the lock was released without adding it. */
+struct cache_line * add_cache_line(disk_sector_t sector_idx, bool read){
   struct cache_line *cl;
-  if(buffer_cache_size > 63){
+  if((size_t) buffer_cache_size >= buffer_cache_capacity){
     cl = evict_cache_line();
+    if(!cl)
+      return NULL;
+    hash_delete(&buffer_cache_index, &cl->hash_elem);
+    stat.evictions ++;
+    if(cl->read_ahead)
+      stat.read_ahead_wasted ++;
   }
-  else{
-    cl = malloc(sizeof *cl);
-    list_push_back(&buffer_cache, &cl->elem);
-    buffer_cache_size ++;
-  }
+  else
+    cl = &buffer_cache[buffer_cache_size ++];
 
-  /* if cl is still null, it is error */
-  if(!cl)
-    PANIC("no space for buffer cache to add");
-  
-  //cl->accessing_processes =1;
   cl->sector_idx = sector_idx;
-  disk_read(filesys_disk, sector_idx, &cl->block);
+  cl->state = CL_LOADING;
+  cl->pin_cnt = 1;
+  cl->dirty = 0;
+  cl->accessed = 0;
+  cl->read_ahead = 0;
+  cl->held = 0;
+  hash_insert(&buffer_cache_index, &cl->hash_elem);
+  policy_insert(cl);
+  if(!read)
+    return cl;
+
+  /* a delayed sector is not on disk yet. it has never been written */
+  if(cache_delayed(sector_idx)){
+    memset(cl->block, 0, DISK_SECTOR_SIZE);
+    cl->state = CL_VALID;
+    return cl;
+  }
+
+  lock_release(&buffer_cache_lock);
+  disk_read(filesys_disk, sector_idx, cl->block);
+  lock_acquire(&buffer_cache_lock);
+
+  cl->state = CL_VALID;
+  cond_broadcast(&cl->io_done, &buffer_cache_lock);
   return cl;
 }
 
 /* select which cache line to evict and do eviction(no need to free and delete. just use it.)
-   algorithm is second-chance algorithm */
+   victim is chosen by buffer_cache_policy. pinned lines and lines in the middle of
+   disk transfer are never chosen.
+   must be called with buffer_cache_lock held. returns null if buffer_cache_lock
+   was released, that is, if every line was pinned or the victim had to be
+   written back first. */
 struct cache_line * evict_cache_line(){
-  struct list_elem *e = list_begin(&buffer_cache);
-  struct cache_line *cl;
-  while(1){
-    cl = list_entry(e, struct cache_line, elem);
-    //if(cl->accessing_processes > 0){
-      //continue;
-    //}
-    if(cl->accessed)
-      cl->accessed = 0;
-    else{
-      if(cl->dirty){/* write-behind */
-        disk_write(filesys_disk, cl->sector_idx, &cl->block);
-      }
+  struct cache_line *cl = policy_select_victim();
+
+  if(cl){
+    if(!cl->dirty){
+      policy_remove(cl);
       return cl;
     }
-    e = list_next(e);
-    if(e == list_end(&buffer_cache))
-      e = list_begin(&buffer_cache);
+
+    /* write-behind without holding buffer_cache_lock.
+       the line keeps its sector while it is written, so read hits on it
+       still work. writers wait for the write to finish, see get_cache_line(). */
+    cl->state = CL_WRITING;
+    cl->pin_cnt ++;
+    cl->dirty = 0;
+    lock_release(&buffer_cache_lock);
+    disk_write(filesys_disk, cl->sector_idx, cl->block);
+    lock_acquire(&buffer_cache_lock);
+    stat.write_backs ++;
+    cl->state = CL_VALID;
+    cond_broadcast(&cl->io_done, &buffer_cache_lock);
+    if(--cl->pin_cnt == 0)
+      cond_broadcast(&cache_line_unpinned, &buffer_cache_lock);
+    return NULL;
   }
+
+  /* every line is in use. wait until one is released. */
+  cond_wait(&cache_line_unpinned, &buffer_cache_lock);
+  return NULL;
+}
+
+/* compares sectors of two cache lines, for qsort() */
+static int cache_line_cmp(const void *a_, const void *b_){
+  const struct cache_line *a = *(struct cache_line * const *) a_;
+  const struct cache_line *b = *(struct cache_line * const *) b_;
+  return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
 }
 
-/* write-behind of all cache lines */
+/* write-behind of all cache lines.
+   dirty lines are written in ascending order of sector, and each run of
+   adjacent sectors goes to disk in one multi-sector transfer.
+   buffer_cache_lock is held only while dirty lines are collected and
+   copied into a bounce buffer, not during the disk writes, so file
+   operations go on while the lines are written. a line stays dirty if it
+   is written to again before its old data reaches disk.
+   lines being accessed at the moment are left for the next call. */
 void write_behind_all(bool done){
-  lock_acquire(&buffer_cache_lock);
+  static struct cache_line **dirty_lines;
+  struct cache_line *run_lines[WRITE_BEHIND_MAX_RUN];
+  unsigned write_gens[WRITE_BEHIND_MAX_RUN];
+  const void *buffers[WRITE_BEHIND_MAX_RUN];
   struct cache_line * cl;
-  struct list_elem * elem = list_begin(&buffer_cache);
-  while(elem != list_end(&buffer_cache)){
-    cl = list_entry(elem, struct cache_line, elem);
-    elem = list_next(elem);
-    if(cl->dirty){
-      disk_write(filesys_disk, cl->sector_idx, &cl->block);
-      cl->dirty = 0;
+  int dirty_cnt = 0;
+  int i, j, run;
+
+  lock_acquire(&write_behind_lock);
+  lock_acquire(&buffer_cache_lock);
+  if(dirty_lines == NULL){
+    dirty_lines = malloc(buffer_cache_capacity * sizeof *dirty_lines);
+    if(dirty_lines == NULL)
+      PANIC("no space for buffer cache write-behind");
+  }
+
+  /* pinning keeps the collected lines from being evicted and reused for
+     other sectors until their runs are written */
+  for(i = 0; i < buffer_cache_size; i++){
+    cl = &buffer_cache[i];
+    if(cl->dirty && idle(cl) && !cache_delayed(cl->sector_idx) && !cl->held){
+      cl->pin_cnt ++;
+      dirty_lines[dirty_cnt++] = cl;
     }
-    /* when called by filesys_done */
-    if(done){
-      list_remove(&cl->elem);
-      buffer_cache_size--;
-      free(cl);
+  }
+  qsort(dirty_lines, dirty_cnt, sizeof *dirty_lines, cache_line_cmp);
+
+  i = 0;
+  while(i < dirty_cnt){
+    /* snapshot a run of adjacent sectors. buffer_cache_lock was released
+       for earlier runs, so a line pinned by a writer or held by a journal
+       transaction since it was collected is skipped. it stays dirty and is
+       written next time. */
+    for(run = 0; i < dirty_cnt && run < WRITE_BEHIND_MAX_RUN; i++){
+      cl = dirty_lines[i];
+      if(run > 0 && cl->sector_idx != run_lines[0]->sector_idx + run)
+        break;
+      if(!cl->dirty || cl->pin_cnt > 1 || cl->held){
+        if(--cl->pin_cnt == 0)
+          cond_broadcast(&cache_line_unpinned, &buffer_cache_lock);
+        continue;
+      }
+      run_lines[run] = cl;
+      write_gens[run] = cl->write_gen;
+      buffers[run] = write_behind_bounce + run * DISK_SECTOR_SIZE;
+      memcpy(write_behind_bounce + run * DISK_SECTOR_SIZE, cl->block, DISK_SECTOR_SIZE);
+      run++;
+    }
+    if(run == 0)
+      continue;
+
+    lock_release(&buffer_cache_lock);
+    disk_write_multiple(filesys_disk, run_lines[0]->sector_idx, buffers, run);
+    lock_acquire(&buffer_cache_lock);
+    stat.write_backs += run;
+
+    for(j = 0; j < run; j++){
+      cl = run_lines[j];
+      if(cl->write_gen == write_gens[j])
+        cl->dirty = 0;
+      if(--cl->pin_cnt == 0)
+        cond_broadcast(&cache_line_unpinned, &buffer_cache_lock);
     }
   }
+
+  /* when called by filesys_done, drop every line */
+  if(done){
+    hash_clear(&buffer_cache_index, NULL);
+    buffer_cache_size = 0;
+    policy_init();
+  }
   lock_release(&buffer_cache_lock);
+  lock_release(&write_behind_lock);
+}
+
+/////////* replacement policies */////////
+/* every policy function is called with buffer_cache_lock held */
+
+static unsigned ghost_hash(const struct hash_elem *e, void *aux UNUSED){
+  const struct ghost_entry *g = hash_entry(e, struct ghost_entry, hash_elem);
+  return hash_int((int) g->sector);
+}
+
+static bool ghost_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+  const struct ghost_entry *a = hash_entry(a_, struct ghost_entry, hash_elem);
+  const struct ghost_entry *b = hash_entry(b_, struct ghost_entry, hash_elem);
+  return a->sector < b->sector;
+}
+
+/* reset state of the policies. a1in gets 1/4 of the cache and
+   a1out remembers as many sectors as half of the cache, as suggested for 2Q. */
+static void policy_init(){
+  static struct ghost_entry *ghosts;
+  size_t ghost_cnt = buffer_cache_capacity / 2;
+  size_t i;
+
+  clock_hand = 0;
+
+  list_init(&a1in);
+  list_init(&am);
+  list_init(&a1out);
+  list_init(&ghost_free);
+  a1in_size = 0;
+  a1in_max = buffer_cache_capacity / 4;
+  if(a1in_max == 0)
+    a1in_max = 1;
+  if(ghosts == NULL){
+    ghosts = calloc(ghost_cnt, sizeof *ghosts);
+    if(ghosts == NULL)
+      PANIC("no space for buffer cache");
+    hash_init(&a1out_index, ghost_hash, ghost_less, NULL);
+  }
+  else
+    hash_clear(&a1out_index, NULL);
+  for(i = 0; i < ghost_cnt; i++)
+    list_push_back(&ghost_free, &ghosts[i].elem);
+}
+
+/* remember that SECTOR has been evicted from a1in */
+static void ghost_add(disk_sector_t sector){
+  struct ghost_entry *g;
+  if(list_empty(&ghost_free)){
+    if(list_empty(&a1out))
+      return;
+    /* forget the oldest one */
+    g = list_entry(list_pop_back(&a1out), struct ghost_entry, elem);
+    hash_delete(&a1out_index, &g->hash_elem);
+  }
+  else
+    g = list_entry(list_pop_front(&ghost_free), struct ghost_entry, elem);
+  g->sector = sector;
+  if(hash_insert(&a1out_index, &g->hash_elem) != NULL){
+    list_push_back(&ghost_free, &g->elem);
+    return;
+  }
+  list_push_front(&a1out, &g->elem);
+}
+
+/* forget SECTOR from a1out. returns true if it was there */
+static bool ghost_remove(disk_sector_t sector){
+  struct ghost_entry key;
+  struct hash_elem *e;
+  struct ghost_entry *g;
+  key.sector = sector;
+  e = hash_delete(&a1out_index, &key.hash_elem);
+  if(e == NULL)
+    return false;
+  g = hash_entry(e, struct ghost_entry, hash_elem);
+  list_remove(&g->elem);
+  list_push_back(&ghost_free, &g->elem);
+  return true;
+}
+
+/* CL is referenced */
+static void policy_touch(struct cache_line *cl){
+  if(buffer_cache_policy == CACHE_POLICY_CLOCK)
+    cl->accessed = 1;
+  /* 2Q: move to the front of am. nothing to do for a1in,
+     since references soon after the first one are correlated. */
+  else if(cl->queue == CQ_AM){
+    list_remove(&cl->queue_elem);
+    list_push_front(&am, &cl->queue_elem);
+  }
+}
+
+/* CL got a new sector */
+static void policy_insert(struct cache_line *cl){
+  cl->queue = CQ_NONE;
+  if(buffer_cache_policy != CACHE_POLICY_2Q)
+    return;
+  if(ghost_remove(cl->sector_idx)){
+    cl->queue = CQ_AM;
+    list_push_front(&am, &cl->queue_elem);
+  }
+  else{
+    cl->queue = CQ_A1IN;
+    list_push_front(&a1in, &cl->queue_elem);
+    a1in_size ++;
+  }
+}
+
+/* CL is going to be evicted */
+static void policy_remove(struct cache_line *cl){
+  if(cl->queue == CQ_NONE)
+    return;
+  list_remove(&cl->queue_elem);
+  if(cl->queue == CQ_A1IN){
+    a1in_size --;
+    ghost_add(cl->sector_idx);
+  }
+  cl->queue = CQ_NONE;
+}
+
+/* returns true if nobody accesses CL, and no disk transfer is going on */
+static bool idle(const struct cache_line *cl){
+  return cl->pin_cnt == 0 && cl->state == CL_VALID;
+}
+
+/* returns true if CL can be evicted now.
+   data of delayed sectors has nowhere to go until the sectors are allocated,
+   and held lines must not reach disk before their journal commit */
+static bool evictable(const struct cache_line *cl){
+  return idle(cl) && !(cl->dirty && cache_delayed(cl->sector_idx)) && !cl->held;
+}
+
+/* find the oldest evictable line on QUEUE */
+static struct cache_line * oldest_evictable(struct list *queue){
+  struct list_elem *e;
+  struct cache_line *cl;
+  for(e = list_rbegin(queue); e != list_rend(queue); e = list_prev(e)){
+    cl = list_entry(e, struct cache_line, queue_elem);
+    if(evictable(cl))
+      return cl;
+  }
+  return NULL;
+}
+
+/* choose a victim line, or return null if none can be evicted now */
+static struct cache_line * policy_select_victim(){
+  struct cache_line *cl = NULL;
+  int scanned;
+
+  if(buffer_cache_policy == CACHE_POLICY_2Q){
+    if(a1in_size > a1in_max)
+      cl = oldest_evictable(&a1in);
+    if(!cl)
+      cl = oldest_evictable(&am);
+    if(!cl)
+      cl = oldest_evictable(&a1in);
+    return cl;
+  }
+
+  /* second-chance clock. two rounds are enough to clear every accessed bit once */
+  for(scanned = 0; scanned < 2 * buffer_cache_size; scanned ++){
+    cl = &buffer_cache[clock_hand];
+    clock_hand = (clock_hand + 1) % buffer_cache_size;
+    if(!evictable(cl))
+      continue;
+    if(cl->accessed){
+      cl->accessed = 0;
+      continue;
+    }
+    return cl;
+  }
+  return NULL;
 }
 
 /////////* added for implementing read-ahead */////////
 
 
-/* produce sectors to read-ahead */
-void read_ahead_put(disk_sector_t sector){
-  struct read_ahead_elem * ra = malloc(sizeof (struct read_ahead_elem));
-  ra->sector = sector;
-  
+/* produce sectors to read-ahead.
+   returns false if the request is dropped, because the sector is
+   already cached or queued, or because the queue is full.
+   delayed sectors are not on disk, so they are dropped as well. */
+bool read_ahead_put(disk_sector_t sector){
+  bool cached;
+  int i;
+
+  if(cache_delayed(sector))
+    return false;
+  lock_acquire(&buffer_cache_lock);
+  cached = find_cache_line(sector) != NULL;
+  lock_release(&buffer_cache_lock);
+  if(cached)
+    return false;
+
   lock_acquire(&read_ahead_lock);
-  list_push_back(&read_ahead_queue,&ra->elem);
+  if(read_ahead_cnt == READ_AHEAD_QUEUE_SIZE)
+    goto drop;
+  for(i = 0; i < read_ahead_cnt; i++)
+    if(read_ahead_queue[(read_ahead_head + i) % READ_AHEAD_QUEUE_SIZE] == sector)
+      goto drop;
+  read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE_SIZE] = sector;
+  read_ahead_cnt ++;
   cond_signal(&not_empty, &read_ahead_lock);
   lock_release(&read_ahead_lock);
+  return true;
+
+ drop:
+  lock_release(&read_ahead_lock);
+  return false;
 }
 
 /* consume sectors to read-ahead to do read-ahead */
-static void read_ahead_get(void *unused){
-  struct read_ahead_elem * ra;
-  struct list_elem * elem;
+static void read_ahead_get(void *unused UNUSED){
+  disk_sector_t sector;
   struct cache_line * cl;
   while(1){
     lock_acquire(&read_ahead_lock);
-    while(list_empty(&read_ahead_queue))
+    while(read_ahead_cnt == 0)
       cond_wait(&not_empty, &read_ahead_lock);
-    elem = list_pop_front(&read_ahead_queue);
+    sector = read_ahead_queue[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+    read_ahead_cnt --;
     lock_release(&read_ahead_lock);
 
-    ra = list_entry(elem, struct read_ahead_elem, elem);
-    
-    /* read sectors */
+    /* read sectors. if add_cache_line() fails to add it, just give up */
     lock_acquire(&buffer_cache_lock);
-    cl = find_cache_line(ra->sector);
+    cl = find_cache_line(sector);
     if(!cl){
-      add_cache_line(ra->sector);
+      cl = add_cache_line(sector, true);
+      if(cl){
+        stat.read_aheads ++;
+        cl->read_ahead = 1;
+        if(--cl->pin_cnt == 0)
+          cond_broadcast(&cache_line_unpinned, &buffer_cache_lock);
+      }
     }
     lock_release(&buffer_cache_lock);
-
-    free(ra);
   }
 }
+
+/////////* statistics */////////
+/* copy buffer cache statistics to ST */
+void cache_get_stat(struct cache_stat *st){
+  lock_acquire(&buffer_cache_lock);
+  *st = stat;
+  lock_release(&buffer_cache_lock);
+}
+
+/* print buffer cache statistics, next to disk_print_stats() at power off */
+void cache_print_stats(){
+  printf("Buffer cache: %lld hits, %lld misses, %lld evictions, %lld write-backs\n",
+         stat.hits, stat.misses, stat.evictions, stat.write_backs);
+  printf("Read-ahead: %lld sectors, %lld hits, %lld wasted\n",
+         stat.read_aheads, stat.read_ahead_hits, stat.read_ahead_wasted);
+}
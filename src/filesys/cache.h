@@ -1,32 +1,100 @@
-/* buffer cache with 64 lines is defined as list of cache_line structures */
+/* buffer cache is defined as array of cache_line structures.
+   the number of lines is set at boot time by -bc option (64 by default). */
 
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
 #include <list.h>
+#include <hash.h>
+#include <cache-stat.h>
 #include "devices/disk.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
-struct list buffer_cache;
+/* default and minimum number of cache lines */
+#define BUFFER_CACHE_DEFAULT_CAPACITY 64
+#define BUFFER_CACHE_MIN_CAPACITY 48
 
+/* sectors from CACHE_DELAYED_BASE on are not on disk. they name blocks of
+   files written with delayed allocation, which stay in the cache until
+   cache_rename() gives them real sectors. a delayed line never written is zeros. */
+#define CACHE_DELAYED_BASE 0x10000000
+#define cache_delayed(SECTOR) ((SECTOR) >= CACHE_DELAYED_BASE)
+
+/* number of cache blocks in one page of the data slab */
+#define CACHE_BLOCKS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* state of a cache line.
+   buffer_cache_lock is released while a line is LOADING or WRITING,
+   so other threads can hit on other lines during the disk transfer. */
+enum cache_line_state{
+  CL_LOADING,                       /* being filled from disk, block is not valid yet */
+  CL_VALID,                         /* block holds data of sector_idx */
+  CL_WRITING                        /* being written back to disk before eviction */
+};
+
+/* replacement policy of buffer cache, selected by -bcp option */
+enum cache_policy{
+  CACHE_POLICY_CLOCK,               /* second-chance clock */
+  CACHE_POLICY_2Q                   /* 2Q, resistant to sequential scans */
+};
+
+/* queue of 2Q policy that a cache line is on */
+enum cache_queue{
+  CQ_NONE,
+  CQ_A1IN,                          /* lines referenced once, FIFO */
+  CQ_AM                             /* lines referenced again after leaving a1in, LRU */
+};
+
+/* metadata of a cache line. lines are kept in one dense array,
+   apart from their blocks, so that eviction scan touches fewer memory. */
 struct cache_line{ 
-  uint8_t block[DISK_SECTOR_SIZE];  /* cache block size = disk sector size = 512B */
+  uint8_t *block;                   /* cache block size = disk sector size = 512B, in data slab */
   disk_sector_t sector_idx;         /* sector index */
   int accessed;                     /* used when we selecting cache line to evict */
   int dirty;                        /* set to 1 when write is done */
-  //int accessing_processes;          /* number of processes accessing this cache line */
-  struct list_elem elem;
+  unsigned write_gen;               /* incremented on every write access */
+  int read_ahead;                   /* set to 1 if read-ahead, until it is accessed */
+  int held;                         /* set to 1 while in an uncommitted journal transaction */
+  enum cache_line_state state;      /* protected by buffer_cache_lock */
+  int pin_cnt;                      /* number of threads accessing this line, pinned if > 0 */
+  struct condition io_done;         /* signaled when LOADING or WRITING is over */
+  struct hash_elem hash_elem;       /* element of buffer_cache_index, keyed by sector_idx */
+  enum cache_queue queue;           /* 2Q queue that queue_elem is on */
+  struct list_elem queue_elem;
 };
 
-int buffer_cache_size;
+/* number of cache lines, set by -bc option */
+extern size_t buffer_cache_capacity;
+/* replacement policy, set by -bcp option */
+extern enum cache_policy buffer_cache_policy;
+
+int buffer_cache_size;                /* number of cache lines in use */
 struct lock buffer_cache_lock;
 
 void init_buffer_cache(void);
-struct cache_line * get_cache_line(disk_sector_t sector_idx, int dirty);
+bool set_buffer_cache_policy(const char *name);
+/* modes of get_cache_line() */
+#define CACHE_READ 0                /* reads the block */
+#define CACHE_WRITE 1               /* modifies part of the block */
+#define CACHE_OVERWRITE 2           /* overwrites the whole block */
+#define CACHE_JOURNAL 4             /* or'ed to a write mode for metadata, see journal.c */
+
+struct cache_line * get_cache_line(disk_sector_t sector_idx, int mode);
+void release_cache_line(struct cache_line *);
+void cache_read(disk_sector_t sector, void *buffer, int ofs, int size);
+void cache_write(disk_sector_t sector, const void *buffer, int ofs, int size);
+void cache_write_journal(disk_sector_t sector, const void *buffer, int ofs, int size);
+void cache_unhold(disk_sector_t sector);
+void cache_flush(disk_sector_t sector);
+bool cache_rename(disk_sector_t from, disk_sector_t to);
+void cache_discard(disk_sector_t sector);
 struct cache_line * find_cache_line(disk_sector_t sector_idx);
-struct cache_line * add_cache_line(disk_sector_t sector_idx);
+struct cache_line * add_cache_line(disk_sector_t sector_idx, bool read);
 struct cache_line * evict_cache_line(void);
 void write_behind_all(bool);
-void read_ahead_put(disk_sector_t sector);
+bool read_ahead_put(disk_sector_t sector);
+void cache_get_stat(struct cache_stat *);
+void cache_print_stats(void);
 
 #endif  /* threads/cache.h */
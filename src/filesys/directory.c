@@ -1,10 +1,17 @@
 #include "filesys/directory.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A single directory entry. */
 struct dir_entry 
@@ -14,11 +21,201 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Hashed directory index.
+   A directory starts linear, as an array of dir_entry, and is indexed
+   when it outgrows its first sector.  An indexed directory starts with
+   DIR_INDEX_SECTORS sectors of index, a header followed by a map from
+   ranges of name hashes to leaf sectors, sorted by hash.  A leaf holds
+   the entries whose hash falls in its range, so lookups and inserts read
+   a few index sectors and one leaf, however large the directory is.
+   A leaf that cannot be split, because its entries share one hash or
+   the map is full, gets more leaves chained to it instead.  Every
+   sector from DIR_INDEX_SECTORS on is a leaf.
+   Linear directories keep working as they are until they are added to. */
+#define DIR_INDEX_MAGIC 0x48545245      /* "HTRE", never a sector number */
+#define DIR_INDEX_SECTORS 4
+#define LEAF_ENTRIES 25
+
+/* Header of the index, at offset 0. */
+struct dir_index
+  {
+    uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+    uint32_t leaf_cnt;                  /* Number of map entries in use. */
+    uint32_t unused[2];
+  };
+
+/* Entry of the map following the header. */
+struct dir_map_entry
+  {
+    uint32_t hash;                      /* Lowest hash of the leaf's range. */
+    uint32_t leaf;                      /* Sector of the leaf in the directory. */
+  };
+
+#define INDEX_MAP_MAX ((DIR_INDEX_SECTORS * DISK_SECTOR_SIZE \
+                        - sizeof (struct dir_index)) / sizeof (struct dir_map_entry))
+
+/* Leaf of an indexed directory.  Must be DISK_SECTOR_SIZE bytes long. */
+struct dir_leaf
+  {
+    uint32_t used;                      /* Number of entries in use. */
+    uint32_t free_hint;                 /* No free entry below this one. */
+    uint32_t next;                      /* Next leaf of the chain, 0 if none. */
+    struct dir_entry entries[LEAF_ENTRIES];
+  };
+
+/* Dentry cache.
+   Maps a directory's sector and a name to the sector of the named
+   inode, or to DENTRY_NEGATIVE if the name is known to be absent, so
+   repeated path walks and failed lookups read no directory data.
+   Entries are recycled least recently used first.  An entry is only
+   used and changed with its directory's inode lock held, which keeps it
+   in step with dir_add and dir_remove; dcache_lock guards the table. */
+#define DCACHE_SIZE 128
+#define DENTRY_NEGATIVE ((disk_sector_t) -1)
+
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache, if in use. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    bool in_use;
+    disk_sector_t parent;               /* Sector of the directory. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    disk_sector_t inode_sector;         /* Or DENTRY_NEGATIVE. */
+  };
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dcache;
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;
+
+static bool is_indexed (struct inode *);
+static bool index_add (struct inode *, const struct dir_entry *);
+static bool index_convert (struct inode *);
+static bool next_entry (struct inode *, off_t *posp, struct dir_entry *);
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dir_init (void)
+{
+  size_t i;
+
+  lock_init (&dcache_lock);
+  hash_init (&dcache, dentry_hash, dentry_less, NULL);
+  list_init (&dcache_lru);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&dcache_lru, &dentries[i].lru_elem);
+}
+
+/* Returns the cached entry for NAME in the directory at PARENT,
+   or a null pointer.  dcache_lock must be held. */
+static struct dentry *
+dcache_find (disk_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory at PARENT in the dentry cache.
+   On a hit, stores the inode sector or DENTRY_NEGATIVE in *SECTOR
+   and returns true. */
+static bool
+dcache_get (disk_sector_t parent, const char *name, disk_sector_t *sector)
+{
+  struct dentry *d = NULL;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      *sector = d->inode_sector;
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory at PARENT refers to the inode
+   at SECTOR, or is absent if SECTOR is DENTRY_NEGATIVE. */
+static void
+dcache_put (disk_sector_t parent, const char *name, disk_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d == NULL)
+    {
+      /* recycle the least recently used entry */
+      d = list_entry (list_back (&dcache_lru), struct dentry, lru_elem);
+      if (d->in_use)
+        hash_delete (&dcache, &d->hash_elem);
+      d->in_use = true;
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->hash_elem);
+    }
+  d->inode_sector = sector;
+  list_remove (&d->lru_elem);
+  list_push_front (&dcache_lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Drops every cached entry of the directory at PARENT, whose sector
+   is about to be freed and may come back as another directory. */
+static void
+dcache_purge (disk_sector_t parent)
+{
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    {
+      struct dentry *d = &dentries[i];
+      if (d->in_use && d->parent == parent)
+        {
+          hash_delete (&dcache, &d->hash_elem);
+          d->in_use = false;
+          list_remove (&d->lru_elem);
+          list_push_back (&dcache_lru, &d->lru_elem);
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) 
 {
+  ASSERT (sizeof (struct dir_leaf) == DISK_SECTOR_SIZE);
   return inode_create (sector, entry_cnt * sizeof (struct dir_entry), 1);
 }
 
@@ -76,6 +273,102 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Reads index header of directory INODE into *IDX.
+   Returns true if INODE is indexed. */
+static bool
+read_index (struct inode *inode, struct dir_index *idx)
+{
+  return inode_read_at (inode, idx, sizeof *idx, 0) == sizeof *idx
+         && idx->magic == DIR_INDEX_MAGIC;
+}
+
+/* Returns true if directory INODE is indexed. */
+static bool
+is_indexed (struct inode *inode)
+{
+  struct dir_index idx;
+  return read_index (inode, &idx);
+}
+
+/* Returns the offset of the I'th map entry of an index. */
+static off_t
+map_ofs (size_t i)
+{
+  return sizeof (struct dir_index) + i * sizeof (struct dir_map_entry);
+}
+
+/* Returns the offset of entry I of the leaf at sector LEAF. */
+static off_t
+leaf_entry_ofs (uint32_t leaf, size_t i)
+{
+  return (off_t) leaf * DISK_SECTOR_SIZE + offsetof (struct dir_leaf, entries)
+         + i * sizeof (struct dir_entry);
+}
+
+/* Finds the map entry of indexed directory INODE whose range holds
+   HASH, by binary search, and stores it into *MP.  IDX is the index
+   header.  Returns the position of the map entry. */
+static size_t
+index_find (struct inode *inode, const struct dir_index *idx, unsigned hash,
+            struct dir_map_entry *mp)
+{
+  size_t lo = 0, hi = idx->leaf_cnt;
+
+  /* the first entry covers hash 0, so the result is never -1 */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      inode_read_at (inode, mp, sizeof *mp, map_ofs (mid));
+      if (mp->hash <= hash)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  ASSERT (lo > 0);
+  inode_read_at (inode, mp, sizeof *mp, map_ofs (lo - 1));
+  return lo - 1;
+}
+
+/* lookup() for an indexed directory INODE. */
+static bool
+index_lookup (struct inode *inode, const char *name,
+              struct dir_entry *ep, off_t *ofsp)
+{
+  struct dir_index idx;
+  struct dir_map_entry m;
+  struct dir_leaf *leaf;
+  uint32_t sector;
+  bool found = false;
+  size_t i;
+
+  leaf = malloc (sizeof *leaf);
+  if (leaf == NULL || !read_index (inode, &idx))
+    goto done;
+  index_find (inode, &idx, hash_string (name), &m);
+
+  /* the leaf for the hash, and the leaves chained to it */
+  for (sector = m.leaf; sector != 0 && !found; sector = leaf->next)
+    {
+      if (inode_read_at (inode, leaf, sizeof *leaf,
+                         (off_t) sector * DISK_SECTOR_SIZE) != sizeof *leaf)
+        goto done;
+      for (i = 0; i < LEAF_ENTRIES; i++)
+        if (leaf->entries[i].in_use && !strcmp (name, leaf->entries[i].name))
+          {
+            if (ep != NULL)
+              *ep = leaf->entries[i];
+            if (ofsp != NULL)
+              *ofsp = leaf_entry_ofs (sector, i);
+            found = true;
+            break;
+          }
+    }
+
+ done:
+  free (leaf);
+  return found;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -91,6 +384,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_indexed (dir->inode))
+    return index_lookup (dir->inode, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -104,6 +400,24 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Returns the inode sector of NAME in DIR, or DENTRY_NEGATIVE if
+   there is none, going to the directory data only on a dentry cache
+   miss.  DIR's inode lock must be held. */
+static disk_sector_t
+cached_lookup (const struct dir *dir, const char *name)
+{
+  disk_sector_t parent = inode_get_inumber (dir->inode);
+  disk_sector_t sector;
+  struct dir_entry e;
+
+  if (!dcache_get (parent, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : DENTRY_NEGATIVE;
+      dcache_put (parent, name, sector);
+    }
+  return sector;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
@@ -112,14 +426,15 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  disk_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   inode_lock_acquire(dir->inode);
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  sector = cached_lookup (dir, name);
+  if (sector != DENTRY_NEGATIVE)
+    *inode = inode_open (sector);
   else
     *inode = NULL;
   inode_lock_release(dir->inode);
@@ -150,12 +465,16 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
     goto done;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (cached_lookup (dir, name) != DENTRY_NEGATIVE)
     goto done;
 
   /* set the file's inode->parent as sector of dir */
   inode_set_parent(inode_sector, dir_get_inode(dir));
 
+  /* an indexed directory puts the entry in the leaf for its hash */
+  if (is_indexed (dir->inode))
+    goto indexed;
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -168,18 +487,36 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
     if (!e.in_use)
       break;
 
+  /* past the first sector, index the directory instead */
+  if (ofs + sizeof e > DISK_SECTOR_SIZE)
+    {
+      if (!index_convert (dir->inode))
+        goto done;
+      goto indexed;
+    }
+
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  goto done;
+
+ indexed:
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  success = index_add (dir->inode, &e);
 
  done:
+  if (success)
+    dcache_put (inode_get_inumber (dir->inode), name, inode_sector);
   inode_lock_release(dir->inode);
   return success;
 }
 
 bool dir_is_nonempty(struct inode *);
+static void leaf_entry_freed (struct inode *, off_t ofs);
 
 /* Removes any entry for NAME in DIR.
    Returns true if successful, false on failure,
@@ -191,13 +528,17 @@ dir_remove (struct dir *dir, const char *name)
   struct inode *inode = NULL;
   bool success = false;
   off_t ofs;
+  disk_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   inode_lock_acquire(dir->inode);
 
-  /* Find directory entry. */
+  /* Find directory entry, unless it is known to be absent. */
+  if (dcache_get (inode_get_inumber (dir->inode), name, &sector)
+      && sector == DENTRY_NEGATIVE)
+    goto done;
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -219,8 +560,13 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  if (is_indexed (dir->inode))
+    leaf_entry_freed (dir->inode, ofs);
 
   /* Remove inode. */
+  dcache_put (inode_get_inumber (dir->inode), name, DENTRY_NEGATIVE);
+  if (inode_is_dir (inode))
+    dcache_purge (inode_get_inumber (inode));
   inode_remove (inode);
   success = true;
 
@@ -237,19 +583,71 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
+  bool success;
+
+  inode_lock_acquire(dir->inode);
+  success = next_entry (dir->inode, &dir->pos, &e);
+  if (success)
+    strlcpy (name, e.name, NAME_MAX + 1);
+  inode_lock_release(dir->inode);
+  return success;
+}
+
+/* Compares the directory entries that A and B point to by
+   inode number, which is the sector of the inode. */
+static int
+dirent_sector_compare (const void *a_, const void *b_)
+{
+  const struct dirent *a = *(const struct dirent **) a_;
+  const struct dirent *b = *(const struct dirent **) b_;
+
+  return a->inumber < b->inumber ? -1 : a->inumber > b->inumber;
+}
+
+/* Reads up to CNT next entries of DIR into ENTS, each with the
+   inode number, type and length of its file.  The entries stay in
+   directory order, but their inodes are queued for read-ahead and
+   then opened in sector order, so that those not cached are read
+   in one sweep.  Returns the number of entries read, 0 if the
+   directory contains no more entries. */
+size_t
+dir_getdents (struct dir *dir, struct dirent *ents, size_t cnt)
+{
+  struct dir_entry e;
+  struct dirent **order;
+  struct inode *inode;
+  size_t n, i;
+
   inode_lock_acquire(dir->inode);
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  for (n = 0; n < cnt && next_entry (dir->inode, &dir->pos, &e); n++)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          inode_lock_release(dir->inode);
-          return true;
-        } 
+      strlcpy (ents[n].name, e.name, sizeof ents[n].name);
+      ents[n].inumber = e.inode_sector;
     }
   inode_lock_release(dir->inode);
-  return false;
+
+  /* without memory for the order, fall back to directory order */
+  order = malloc (n * sizeof *order);
+  if (order != NULL)
+    {
+      for (i = 0; i < n; i++)
+        order[i] = &ents[i];
+      qsort (order, n, sizeof *order, dirent_sector_compare);
+    }
+
+  for (i = 0; i < n; i++)
+    read_ahead_put (order != NULL ? order[i]->inumber : ents[i].inumber);
+  for (i = 0; i < n; i++)
+    {
+      struct dirent *d = order != NULL ? order[i] : &ents[i];
+
+      inode = inode_open (d->inumber);
+      d->is_dir = inode != NULL && inode_is_dir (inode);
+      d->length = inode != NULL ? inode_length (inode) : 0;
+      inode_close (inode);
+    }
+  free (order);
+  return n;
 }
 
 /////////* newly made functions for project 4 */////////
@@ -272,14 +670,228 @@ dir_is_root(struct dir* dir)
 bool
 dir_is_nonempty(struct inode *inode){
   struct dir_entry e;
-  off_t ofs;
+  off_t pos = 0;
 
-  for(ofs = 0; inode_read_at(inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e)
-    if(e.in_use)
-      goto done;
+  return next_entry(inode, &pos, &e);
+}
+
+/* reads the next entry in use of directory INODE from position *POSP
+   into *EP, and advances *POSP past it. returns false at the end.
+   a position is a byte offset in a linear directory, and an entry
+   number counted over the leaves, in sector order, in an indexed one,
+   so that chained leaves are covered as well. */
+static bool
+next_entry(struct inode *inode, off_t *posp, struct dir_entry *ep){
+  struct dir_index idx;
+
+  if(!read_index(inode, &idx)){
+    while(inode_read_at(inode, ep, sizeof *ep, *posp) == sizeof *ep){
+      *posp += sizeof *ep;
+      if(ep->in_use)
+        return true;
+    }
+    return false;
+  }
 
+  while(inode_read_at(inode, ep, sizeof *ep,
+                      leaf_entry_ofs(DIR_INDEX_SECTORS + *posp / LEAF_ENTRIES,
+                                     *posp % LEAF_ENTRIES)) == sizeof *ep){
+    (*posp)++;
+    if(ep->in_use)
+      return true;
+  }
   return false;
+}
+
+/* updates the header of the leaf whose entry at OFS has been erased */
+static void
+leaf_entry_freed(struct inode *inode, off_t ofs){
+  struct dir_leaf hdr;
+  off_t leaf_ofs = ofs - ofs % DISK_SECTOR_SIZE;
+  uint32_t i = (ofs % DISK_SECTOR_SIZE - offsetof(struct dir_leaf, entries))
+               / sizeof(struct dir_entry);
+
+  inode_read_at(inode, &hdr, offsetof(struct dir_leaf, entries), leaf_ofs);
+  hdr.used--;
+  if(i < hdr.free_hint)
+    hdr.free_hint = i;
+  inode_write_at(inode, &hdr, offsetof(struct dir_leaf, entries), leaf_ofs);
+}
+
+/* returns the index of the entry of SORTED, sorted by HASHES, where
+   CNT entries are split in two leaves. entries of a hash never go to
+   different leaves, so returns 0 if all hashes are the same. */
+static size_t
+split_point(const unsigned hashes[], size_t cnt){
+  size_t d, k;
+
+  for(d = 0; d < cnt / 2; d++){
+    k = cnt / 2 + d;
+    if(k < cnt && hashes[k - 1] != hashes[k])
+      return k;
+    k = cnt / 2 - d;
+    if(k > 0 && hashes[k - 1] != hashes[k])
+      return k;
+  }
+  return 0;
+}
+
+/* adds entry E to indexed directory INODE, into the first leaf with
+   room on the chain of the leaf for its hash. if the chain is full, a
+   leaf without a chain is split in two by hash, and otherwise, or if
+   its entries share one hash or the map is full, a new leaf is chained
+   to the last one. new leaves go to the end of the directory.
+   returns false if a disk or memory error occurs. */
+static bool
+index_add(struct inode *inode, const struct dir_entry *e){
+  struct dir_index idx;
+  struct dir_map_entry m, new_m;
+  struct dir_leaf *leaf = NULL;
+  struct dir_entry *all = NULL;
+  unsigned *hashes = NULL;
+  unsigned hash = hash_string(e->name);
+  bool success = false;
+  size_t pos, i, j, split;
+  uint32_t sector, new_leaf;
+
+  leaf = malloc(sizeof *leaf);
+  if(leaf == NULL || !read_index(inode, &idx))
+    goto done;
+  pos = index_find(inode, &idx, hash, &m);
+  for(sector = m.leaf; ; sector = leaf->next){
+    if(inode_read_at(inode, leaf, sizeof *leaf, (off_t) sector * DISK_SECTOR_SIZE) != sizeof *leaf)
+      goto done;
+
+    /* room in the leaf */
+    if(leaf->used < LEAF_ENTRIES){
+      for(i = leaf->free_hint; i < LEAF_ENTRIES; i++)
+        if(!leaf->entries[i].in_use)
+          break;
+      ASSERT(i < LEAF_ENTRIES);
+      leaf->entries[i] = *e;
+      leaf->used++;
+      leaf->free_hint = i + 1;
+      success = inode_write_at(inode, leaf, sizeof *leaf,
+                               (off_t) sector * DISK_SECTOR_SIZE) == sizeof *leaf;
+      goto done;
+    }
+    if(leaf->next == 0)
+      break;
+  }
+  new_leaf = DIV_ROUND_UP(inode_length(inode), DISK_SECTOR_SIZE);
+  if(new_leaf <= DIR_INDEX_SECTORS)
+    new_leaf = DIR_INDEX_SECTORS + 1;
+  if(sector != m.leaf || idx.leaf_cnt >= INDEX_MAP_MAX)
+    goto chain;
+
+  /* split. sort the entries of the leaf and E by hash, by insertion */
+  all = malloc((LEAF_ENTRIES + 1) * sizeof *all);
+  hashes = malloc((LEAF_ENTRIES + 1) * sizeof *hashes);
+  if(all == NULL || hashes == NULL)
+    goto done;
+  for(i = 0; i <= LEAF_ENTRIES; i++){
+    const struct dir_entry *x = i < LEAF_ENTRIES ? &leaf->entries[i] : e;
+    unsigned h = hash_string(x->name);
+    for(j = i; j > 0 && hashes[j - 1] > h; j--){
+      hashes[j] = hashes[j - 1];
+      all[j] = all[j - 1];
+    }
+    hashes[j] = h;
+    all[j] = *x;
+  }
+  split = split_point(hashes, LEAF_ENTRIES + 1);
+  if(split == 0)
+    goto chain;
+
+  new_m.hash = hashes[split];
+  new_m.leaf = new_leaf;
+
+  /* upper half to the new leaf, lower half stays */
+  memset(leaf, 0, sizeof *leaf);
+  memcpy(leaf->entries, all + split, (LEAF_ENTRIES + 1 - split) * sizeof *all);
+  leaf->used = leaf->free_hint = LEAF_ENTRIES + 1 - split;
+  if(inode_write_at(inode, leaf, sizeof *leaf,
+                    (off_t) new_m.leaf * DISK_SECTOR_SIZE) != sizeof *leaf)
+    goto done;
+  memset(leaf, 0, sizeof *leaf);
+  memcpy(leaf->entries, all, split * sizeof *all);
+  leaf->used = leaf->free_hint = split;
+  if(inode_write_at(inode, leaf, sizeof *leaf,
+                    (off_t) m.leaf * DISK_SECTOR_SIZE) != sizeof *leaf)
+    goto done;
+
+  /* insert the new leaf into the map after the old one */
+  for(i = idx.leaf_cnt; i > pos + 1; i--){
+    inode_read_at(inode, &m, sizeof m, map_ofs(i - 1));
+    inode_write_at(inode, &m, sizeof m, map_ofs(i));
+  }
+  inode_write_at(inode, &new_m, sizeof new_m, map_ofs(pos + 1));
+  idx.leaf_cnt++;
+  success = inode_write_at(inode, &idx, sizeof idx, 0) == sizeof idx;
+  goto done;
+
+ chain:
+  /* E alone in a new leaf, linked from SECTOR, the last of the chain */
+  memset(leaf, 0, sizeof *leaf);
+  leaf->entries[0] = *e;
+  leaf->used = leaf->free_hint = 1;
+  if(inode_write_at(inode, leaf, sizeof *leaf,
+                    (off_t) new_leaf * DISK_SECTOR_SIZE) != sizeof *leaf)
+    goto done;
+  success = inode_write_at(inode, &new_leaf, sizeof new_leaf,
+                           (off_t) sector * DISK_SECTOR_SIZE
+                           + offsetof(struct dir_leaf, next)) == sizeof new_leaf;
+
+ done:
+  free(hashes);
+  free(all);
+  free(leaf);
+  return success;
+}
+
+/* converts linear directory INODE to an indexed one, with the entries
+   it has. returns false if a disk or memory error occurs. */
+static bool
+index_convert(struct inode *inode){
+  off_t length = inode_length(inode);
+  size_t cnt = length / sizeof(struct dir_entry);
+  struct dir_entry *entries;
+  struct dir_leaf *leaf;
+  struct dir_index idx;
+  struct dir_map_entry m;
+  bool success = false;
+  size_t i;
 
-done:
-  return true;
+  entries = malloc(cnt * sizeof *entries);
+  leaf = calloc(1, sizeof *leaf);
+  if(entries == NULL || leaf == NULL)
+    goto done;
+  if(inode_read_at(inode, entries, cnt * sizeof *entries, 0) != (off_t) (cnt * sizeof *entries))
+    goto done;
+
+  /* clear the index sectors the entries were in, and make one empty leaf */
+  for(i = 0; i < DIR_INDEX_SECTORS && (off_t) (i * DISK_SECTOR_SIZE) < length; i++)
+    if(inode_write_at(inode, leaf, DISK_SECTOR_SIZE, i * DISK_SECTOR_SIZE) != DISK_SECTOR_SIZE)
+      goto done;
+  if(inode_write_at(inode, leaf, sizeof *leaf,
+                    DIR_INDEX_SECTORS * DISK_SECTOR_SIZE) != sizeof *leaf)
+    goto done;
+  m.hash = 0;
+  m.leaf = DIR_INDEX_SECTORS;
+  inode_write_at(inode, &m, sizeof m, map_ofs(0));
+  memset(&idx, 0, sizeof idx);
+  idx.magic = DIR_INDEX_MAGIC;
+  idx.leaf_cnt = 1;
+  if(inode_write_at(inode, &idx, sizeof idx, 0) != sizeof idx)
+    goto done;
+
+  success = true;
+  for(i = 0; i < cnt && success; i++)
+    if(entries[i].in_use)
+      success = index_add(inode, &entries[i]);
+
+ done:
+  free(leaf);
+  free(entries);
+  return success;
 }
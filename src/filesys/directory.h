@@ -13,6 +13,12 @@
 #define NAME_MAX 14
 
 struct inode;
+struct dirent;
+
+/* Most sectors of a directory changed by dir_add() and dir_remove(),
+   which the journal handles of their callers must have credits for. */
+#define DIR_ADD_CREDITS 6
+#define DIR_REMOVE_CREDITS 1
 
 /* A directory. */
 struct dir
@@ -21,6 +27,8 @@ struct dir
   off_t pos;              /* Current position */
 };
 
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (disk_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -34,5 +42,6 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, disk_sector_t);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_getdents (struct dir *, struct dirent *, size_t cnt);
 
 #endif /* filesys/directory.h */
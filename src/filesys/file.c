@@ -1,6 +1,7 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/disk.h"
 #include "threads/malloc.h"
 
 /* An open file. */
@@ -9,8 +10,18 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read-ahead stream state. */
+    off_t ra_next;              /* Offset a sequential read would start at. */
+    off_t ra_end;               /* End of the range already read ahead. */
+    int ra_window;              /* Read-ahead window, in sectors. */
   };
 
+/* Maximum read-ahead window, in sectors. */
+#define READ_AHEAD_MAX_WINDOW 16
+
+static void file_read_ahead (struct file *, off_t ofs, off_t size);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +34,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,6 +83,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,7 +96,9 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  file_read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -166,3 +183,41 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Updates FILE's read-ahead stream after SIZE bytes were read at
+   OFS, and reads ahead the sectors after them.
+   The window doubles (2, 4, 8... sectors) while FILE is read
+   sequentially and halves on every random access.  Sectors
+   already read ahead by this stream are not queued again. */
+static void
+file_read_ahead (struct file *file, off_t ofs, off_t size)
+{
+  off_t start, end;
+
+  if (size <= 0)
+    return;
+
+  if (ofs == file->ra_next)
+    {
+      if (file->ra_window == 0)
+        file->ra_window = 2;
+      else if (file->ra_window < READ_AHEAD_MAX_WINDOW)
+        file->ra_window *= 2;
+    }
+  else
+    {
+      file->ra_window /= 2;
+      file->ra_end = 0;
+    }
+  file->ra_next = ofs + size;
+  if (file->ra_window == 0)
+    return;
+
+  start = file->ra_next > file->ra_end ? file->ra_next : file->ra_end;
+  end = file->ra_next + file->ra_window * DISK_SECTOR_SIZE;
+  if (start < end)
+    {
+      inode_read_ahead (file->inode, start, end - start);
+      file->ra_end = end;
+    }
+}
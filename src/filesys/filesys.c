@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "devices/disk.h"
 #include "filesys/cache.h"
 #include "threads/thread.h"
@@ -14,9 +15,32 @@
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* Superblock, at SUPERBLOCK_SECTOR.  Records the layout the disk was
+   formatted with, and whether the file system was shut down cleanly.
+   A clean shutdown also saves the free sector count of each block
+   group, so that the next boot reads the free map a group at a time,
+   as it is used, instead of all of it. */
+#define SUPERBLOCK_MAGIC 0x53555052     /* "SUPR" */
+#define SUPERBLOCK_GROUPS 120
+
+struct superblock
+  {
+    uint32_t magic;                     /* SUPERBLOCK_MAGIC. */
+    uint32_t sector_cnt;                /* Size of the disk. */
+    uint32_t journal_sector;            /* JOURNAL_SECTOR. */
+    uint32_t journal_sectors;           /* JOURNAL_SECTORS. */
+    uint32_t clean;                     /* Shut down cleanly? */
+    uint32_t free_cnt;                  /* Free sectors, if clean. */
+    uint32_t group_cnt;                 /* Counts in group_free, if clean. */
+    uint32_t unused;
+    uint32_t group_free[SUPERBLOCK_GROUPS]; /* Free sectors of each group. */
+  };
+
+static struct superblock superblock;
+
 static void do_format (void);
-struct dir * get_dir (const char *);
-char *get_filename (const char *);
+static void superblock_write (bool clean);
+struct dir * get_dir (const char *, char **);
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -27,13 +51,28 @@ filesys_init (bool format)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
   inode_init ();
+  dir_init ();
   init_buffer_cache ();
   free_map_init ();
+  journal_init ();
 
   if (format) 
     do_format ();
 
-  free_map_open ();
+  journal_open ();
+
+  /* after a clean shutdown, the free map is read as it is used */
+  disk_read (filesys_disk, SUPERBLOCK_SECTOR, &superblock);
+  if (superblock.magic != SUPERBLOCK_MAGIC
+      || superblock.sector_cnt != disk_size (filesys_disk)
+      || superblock.journal_sector != JOURNAL_SECTOR
+      || superblock.journal_sectors != JOURNAL_SECTORS)
+    PANIC ("bad superblock, file system must be formatted");
+  if (superblock.clean && superblock.group_cnt > 0)
+    free_map_open (superblock.group_free, superblock.group_cnt);
+  else
+    free_map_open (NULL, 0);
+  superblock_write (false);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -41,8 +80,11 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_allocate_delayed_all ();
   free_map_close ();
+  journal_close ();
   write_behind_all (true);
+  superblock_write (true);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -53,24 +95,36 @@ bool
 filesys_create (const char *name, off_t initial_size, int is_dir) 
 {
   disk_sector_t inode_sector = 0;
+  size_t cnt;
   bool success = false;
+  bool journaled;
   
   /* tokenize name to get filename and directory's name */
-  char *filename = get_filename(name);
-  struct dir *dir = get_dir(name);
+  char *filename;
+  struct dir *dir = get_dir(name, &filename);
+
+  /* the inode, the directory entry and the free map change together.
+     the handle has credits for them, and for the directory's inode and
+     last extent blocks, which change if the directory grows */
+  journaled = (dir != NULL
+               && journal_begin (1 + DIR_ADD_CREDITS
+                                 + inode_journal_credits (dir_get_inode (dir))));
 
   /* disallow creation with filename = '.' or '..' */
-  if(strcmp(filename, ".") != 0 && strcmp(filename, "..") != 0)
+  if(journaled && strcmp(filename, ".") != 0 && strcmp(filename, "..") != 0)
   {
-    success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, is_dir)
-                  && dir_add (dir, filename, inode_sector));
+    success = (/* in the block group of the parent directory */
+               free_map_allocate_run (inode_get_inumber (dir_get_inode (dir)),
+                                      1, &inode_sector, &cnt)
+               && inode_create (inode_sector, initial_size, is_dir)
+               && dir_add (dir, filename, inode_sector));
   }
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
   free(filename);
+  if (journaled)
+    journal_end ();
 
   return success;
 }
@@ -88,8 +142,8 @@ filesys_open (const char *name)
   struct inode *inode = NULL;
 
   /* tokenize name to get filename and directory's name */
-  char *filename = get_filename(name);
-  struct dir *dir = get_dir(name);
+  char *filename;
+  struct dir *dir = get_dir(name, &filename);
   
   if (dir != NULL){
     if(strcmp(filename, "..") == 0){
@@ -129,12 +183,20 @@ bool
 filesys_remove (const char *name) 
 {
   /* tokenize name to get filename and directory's name */
-  char *filename = get_filename(name);
-  struct dir *dir = get_dir(name);
+  char *filename;
+  struct dir *dir = get_dir(name, &filename);
+  bool success = false;
+  bool journaled;
 
-  bool success = dir != NULL && dir_remove (dir, filename);
+  journaled = (dir != NULL
+               && journal_begin (DIR_REMOVE_CREDITS
+                                 + inode_journal_credits (dir_get_inode (dir))));
+  if (journaled)
+    success = dir_remove (dir, filename);
   dir_close (dir); 
   free(filename);
+  if (journaled)
+    journal_end ();
 
   return success;
 }
@@ -144,30 +206,48 @@ static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_create ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
+  superblock_write (false);
   printf ("done.\n");
 }
 
-/////////* newly made functions for project 4 */////////
-char * get_filename (const char * name)
+/* Writes the superblock, marking the file system clean if CLEAN is
+   true, with the free counts of the block groups, and in use
+   otherwise. */
+static void
+superblock_write (bool clean)
 {
-  char s[strlen(name) + 1];
-  memcpy(s, name, strlen(name) + 1);
+  size_t i;
 
-  char *token, *save_ptr, *prev_token = "";
-  char *filename;
-  for (token = strtok_r(s, "/", &save_ptr); token != NULL; token = strtok_r (NULL, "/", &save_ptr))
-    prev_token = token;
-
-  filename = malloc(strlen(prev_token) + 1);
-  memcpy(filename, prev_token, strlen(prev_token) + 1);
-  return filename;
+  ASSERT (sizeof superblock == DISK_SECTOR_SIZE);
+  memset (&superblock, 0, sizeof superblock);
+  superblock.magic = SUPERBLOCK_MAGIC;
+  superblock.sector_cnt = disk_size (filesys_disk);
+  superblock.journal_sector = JOURNAL_SECTOR;
+  superblock.journal_sectors = JOURNAL_SECTORS;
+  superblock.clean = clean;
+  if (clean)
+    {
+      superblock.group_cnt = free_map_summary (superblock.group_free,
+                                               SUPERBLOCK_GROUPS);
+      for (i = 0; i < superblock.group_cnt; i++)
+        superblock.free_cnt += superblock.group_free[i];
+    }
+  disk_write (filesys_disk, SUPERBLOCK_SECTOR, &superblock);
 }
 
-struct dir * get_dir (const char * name)
+/////////* newly made functions for project 4 */////////
+/* opens the directory that holds the last component of path NAME, and
+   stores a copy of that component into *FILENAME, to be freed by the caller.
+   *FILENAME is empty if NAME has no component, as "/".
+   the path is copied and tokenized once, and each component is looked up
+   through the dentry cache. returns a null pointer if a directory on the
+   way does not exist, with *FILENAME set all the same. */
+struct dir * get_dir (const char * name, char **filename)
 {
   char s[strlen(name) + 1];
   memcpy(s, name, strlen(name) + 1);
@@ -181,35 +261,37 @@ struct dir * get_dir (const char * name)
     dir = dir_reopen(thread_current()->dir);
 
   prev_token = strtok_r(s, "/", &save_ptr);
-  for(token = strtok_r(NULL, "/", &save_ptr); token != NULL; token = strtok_r(NULL, "/", &save_ptr))
+  for(token = strtok_r(NULL, "/", &save_ptr); token != NULL && dir != NULL; token = strtok_r(NULL, "/", &save_ptr))
   {
-    if(strcmp(prev_token, ".") == 0)
-      continue;
-    else if(strcmp(prev_token, "..") == 0)
+    if(strcmp(prev_token, ".") != 0)
     {
-      inode = dir_get_parent(dir);
-      if(inode == NULL)
-        return NULL;
-    }
-    else if(dir_lookup(dir, prev_token, &inode) == false)
-      return NULL;
+      if(strcmp(prev_token, "..") == 0)
+        inode = dir_get_parent(dir);
+      else
+        dir_lookup(dir, prev_token, &inode);
 
-    if(inode_is_dir(inode))
-    {
+      /* a missing component or a file in the middle ends the walk */
+      if(inode != NULL && !inode_is_dir(inode))
+      {
+        inode_close(inode);
+        inode = NULL;
+      }
       dir_close(dir);
       dir = dir_open(inode);
     }
-    else
-      inode_close(inode);
-
     prev_token = token;
   }
+
+  if(prev_token == NULL)
+    prev_token = "";
+  *filename = malloc(strlen(prev_token) + 1);
+  memcpy(*filename, prev_token, strlen(prev_token) + 1);
   return dir;
 }
 
 bool filesys_chdir (const char * name){
-  char *filename = get_filename(name);
-  struct dir *dir = get_dir(name);
+  char *filename;
+  struct dir *dir = get_dir(name, &filename);
   struct inode *parent_inode = NULL;
 
   if(dir == NULL)
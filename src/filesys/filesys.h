@@ -8,6 +8,13 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+/* Superblock, see filesys.c. */
+#define SUPERBLOCK_SECTOR 2     /* Superblock sector. */
+
+/* Metadata journal, see journal.c. */
+#define JOURNAL_SECTOR 3        /* First sector of the journal. */
+#define JOURNAL_SECTORS 128     /* Number of sectors of the journal. */
+
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
@@ -1,76 +1,438 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 
-//static struct lock free_map_lock;    /* Free map lock for synchronization */
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* Number of sectors in a block group.  The bits of one group fill
+   exactly one sector of the free map file. */
+#define GROUP_SECTORS (DISK_SECTOR_SIZE * 8)
+
+/* Block group.  The disk is split into groups of GROUP_SECTORS
+   sectors, each with its own lock, so that allocations in different
+   groups do not contend, and with a count of its free sectors, so that
+   full groups are skipped without scanning their bits.
+   After a clean shutdown the counts come from the superblock, and the
+   bits of a group are read from the free map file when first used. */
+struct group
+  {
+    struct lock lock;                /* Protects the group's bits and below. */
+    size_t free_cnt;                 /* Number of free sectors. */
+    bool dirty;                      /* Changed since written to the file? */
+    bool loaded;                     /* Bits read from the file? */
+  };
+static struct group *groups;
+static size_t group_cnt;
+
+static struct lock free_map_lock;    /* Protects the two counts below. */
+static size_t free_cnt;              /* Number of free sectors. */
+static size_t reserved_cnt;          /* Free sectors promised to delayed allocation. */
+
+/* Serializes free_map_write() with free_map_close(), so that a
+   commit never writes through a closed free map file. */
+static struct lock flush_lock;
+
+static void count_groups (void);
+static void group_load (size_t g);
+static size_t claim (size_t cnt, bool reserved);
+static void unclaim (size_t cnt, bool reserved);
+static bool allocate_run (disk_sector_t goal, size_t cnt,
+                          disk_sector_t *sectorp, size_t *cntp);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  size_t i;
+
   free_map = bitmap_create (disk_size (filesys_disk));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
-  //lock_init(&free_map_lock);
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  groups = calloc (group_cnt, sizeof *groups);
+  if (groups == NULL)
+    PANIC ("no space for block groups");
+  for (i = 0; i < group_cnt; i++)
+    {
+      lock_init (&groups[i].lock);
+      groups[i].loaded = true;
+    }
+  lock_init(&free_map_lock);
+  lock_init (&flush_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, SUPERBLOCK_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  count_groups ();
+  reserved_cnt = 0;
+}
+
+/* Recounts free sectors of every group, and of the whole disk. */
+static void
+count_groups (void)
+{
+  size_t i, start, cnt;
+
+  free_cnt = 0;
+  for (i = 0; i < group_cnt; i++)
+    {
+      start = i * GROUP_SECTORS;
+      cnt = bitmap_size (free_map) - start < GROUP_SECTORS
+            ? bitmap_size (free_map) - start : GROUP_SECTORS;
+      groups[i].free_cnt = bitmap_count (free_map, start, cnt, false);
+      groups[i].dirty = false;
+      free_cnt += groups[i].free_cnt;
+    }
+}
+
+/* Reads the bits of group G from the free map file, unless they are
+   in memory already.  Must be called with G's lock held. */
+static void
+group_load (size_t g)
+{
+  size_t start = g * GROUP_SECTORS;
+  size_t cnt = bitmap_size (free_map) - start < GROUP_SECTORS
+               ? bitmap_size (free_map) - start : GROUP_SECTORS;
+
+  if (groups[g].loaded)
+    return;
+  if (!bitmap_read_range (free_map, free_map_file, start, cnt))
+    PANIC ("can't read free map");
+  ASSERT (bitmap_count (free_map, start, cnt, false) == groups[g].free_cnt);
+  groups[g].loaded = true;
+}
+
+/* Takes up to CNT sectors out of the free count, from the sectors
+   reserved for delayed allocation if RESERVED is true, and from the
+   rest otherwise.  Returns the number taken. */
+static size_t
+claim (size_t cnt, bool reserved)
+{
+  lock_acquire (&free_map_lock);
+  if (reserved)
+    {
+      ASSERT (reserved_cnt >= cnt);
+      reserved_cnt -= cnt;
+    }
+  else if (cnt > free_cnt - reserved_cnt)
+    cnt = free_cnt - reserved_cnt;
+  free_cnt -= cnt;
+  lock_release (&free_map_lock);
+  return cnt;
+}
+
+/* Gives back CNT sectors taken by claim() but not allocated. */
+static void
+unclaim (size_t cnt, bool reserved)
+{
+  lock_acquire (&free_map_lock);
+  free_cnt += cnt;
+  if (reserved)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Allocates a run of up to CNT consecutive sectors, preferably
+   starting at GOAL, and stores the first into *SECTORP and the run
+   length into *CNTP.
+   If GOAL is free the run starts there, so that a file grown with
+   GOAL just past its last sector stays contiguous.  Otherwise the
+   first run of CNT free sectors in GOAL's block group is used, then
+   one in the following groups, and failing that the longest prefix
+   of CNT available at the first free sector.  Runs never cross
+   block groups.
+   Returns true if successful, false if the disk is full. */
+bool
+free_map_allocate_run (disk_sector_t goal, size_t cnt,
+                       disk_sector_t *sectorp, size_t *cntp)
+{
+  cnt = claim (cnt, false);
+  if (cnt == 0)
+    return false;
+  if (!allocate_run (goal, cnt, sectorp, cntp))
+    {
+      unclaim (cnt, false);
+      return false;
+    }
+  unclaim (cnt - *cntp, false);
+  return true;
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
-   Returns true if successful, false if all sectors were
-   available. */
+/* Reserves CNT free sectors for delayed allocation, so that they can
+   be allocated later by free_map_allocate_reserved() even if the disk
+   fills up meanwhile.
+   Returns false if fewer than CNT unreserved sectors are free. */
 bool
-free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
+free_map_reserve (size_t cnt)
 {
-  //lock_acquire(&free_map_lock);
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved by free_map_reserve(). */
+void
+free_map_unreserve (size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
+/* Like free_map_allocate_run(), but allocates from sectors reserved
+   by free_map_reserve(), whose reservation ends for the sectors
+   allocated. */
+bool
+free_map_allocate_reserved (disk_sector_t goal, size_t cnt,
+                            disk_sector_t *sectorp, size_t *cntp)
+{
+  claim (cnt, true);
+  if (!allocate_run (goal, cnt, sectorp, cntp))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      unclaim (cnt, true);
+      return false;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  //lock_release(&free_map_lock);
-  return sector != BITMAP_ERROR;
+  unclaim (cnt - *cntp, true);
+  return true;
+}
+
+/* Returns the first sector of a run of CNT free sectors in group G
+   at or after START, or BITMAP_ERROR if there is none.
+   Must be called with G's lock held. */
+static size_t
+group_scan (size_t g, size_t start, size_t cnt)
+{
+  size_t end = (g + 1) * GROUP_SECTORS;
+  size_t i;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  for (i = start; i + cnt <= end; i++)
+    if (!bitmap_test (free_map, i) && bitmap_none (free_map, i, cnt))
+      return i;
+  return BITMAP_ERROR;
+}
+
+/* Marks the run of up to CNT free sectors from SECTOR in group G as
+   used, and returns its length.
+   Must be called with G's lock held. */
+static size_t
+group_take (size_t g, size_t sector, size_t cnt)
+{
+  size_t end = (g + 1) * GROUP_SECTORS;
+  size_t run;
+
+  if (end > bitmap_size (free_map))
+    end = bitmap_size (free_map);
+  for (run = 1; run < cnt && sector + run < end; run++)
+    if (bitmap_test (free_map, sector + run))
+      break;
+  bitmap_set_multiple (free_map, sector, run, true);
+  groups[g].free_cnt -= run;
+  groups[g].dirty = true;
+  return run;
+}
+
+/* Does the work of the allocation functions, for CNT sectors already
+   taken out of the free count. */
+static bool
+allocate_run (disk_sector_t goal, size_t cnt,
+              disk_sector_t *sectorp, size_t *cntp)
+{
+  size_t first, g, k, sector;
+  int pass;
+
+  ASSERT (cnt > 0 && cnt <= GROUP_SECTORS);
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  first = goal / GROUP_SECTORS;
+
+  /* Pass 0 looks for a whole run, GOAL's group first.  Pass 1 takes
+     whatever is free. */
+  for (pass = 0; pass < 2; pass++)
+    for (k = 0; k < group_cnt; k++)
+      {
+        struct group *grp;
+        size_t start;
+
+        g = (first + k) % group_cnt;
+        grp = &groups[g];
+        /* Unlocked peek at the summary, to skip full groups. */
+        if (grp->free_cnt < (pass == 0 ? cnt : 1))
+          continue;
+        start = k == 0 ? goal : g * GROUP_SECTORS;
+
+        lock_acquire (&grp->lock);
+        group_load (g);
+        if (k == 0 && !bitmap_test (free_map, goal))
+          sector = goal;
+        else
+          {
+            sector = group_scan (g, start, pass == 0 ? cnt : 1);
+            if (sector == BITMAP_ERROR && k == 0)
+              sector = group_scan (g, g * GROUP_SECTORS, pass == 0 ? cnt : 1);
+          }
+        if (sector != BITMAP_ERROR)
+          {
+            *sectorp = sector;
+            *cntp = group_take (g, sector, cnt);
+            lock_release (&grp->lock);
+            return true;
+          }
+        lock_release (&grp->lock);
+      }
+  return false;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
-  //lock_acquire(&free_map_lock);
-  ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
-  //lock_release(&free_map_lock);
+  while (cnt > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = (g + 1) * GROUP_SECTORS - sector;
+
+      if (n > cnt)
+        n = cnt;
+      lock_acquire (&groups[g].lock);
+      group_load (g);
+      ASSERT (bitmap_all (free_map, sector, n));
+      bitmap_set_multiple (free_map, sector, n, false);
+      groups[g].free_cnt += n;
+      groups[g].dirty = true;
+      lock_release (&groups[g].lock);
+
+      lock_acquire (&free_map_lock);
+      free_cnt += n;
+      lock_release (&free_map_lock);
+
+      journal_revoke (sector, n);
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Commits the changes of the free map through the journal, which
+   writes them with every transaction.  Called by the periodic writer
+   and when the free map is closed. */
+void
+free_map_flush (void)
+{
+  journal_begin (0);
+  journal_end ();
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Writes the bits of changed block groups to the free map file.
+   Called by the journal as it commits a transaction, so that the
+   sectors allocated and released up to then go with it. */
 void
-free_map_open (void) 
+free_map_write (void)
 {
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t g, start;
+
+  lock_acquire (&flush_lock);
+  if (free_map_file == NULL)
+    {
+      lock_release (&flush_lock);
+      return;
+    }
+  for (g = 0; g < group_cnt; g++)
+    {
+      lock_acquire (&groups[g].lock);
+      if (groups[g].dirty)
+        {
+          start = g * GROUP_SECTORS;
+          if (bitmap_write_range (free_map, free_map_file, start,
+                                  bit_cnt - start < GROUP_SECTORS
+                                  ? bit_cnt - start : GROUP_SECTORS))
+            groups[g].dirty = false;
+        }
+      lock_release (&groups[g].lock);
+    }
+  lock_release (&flush_lock);
+}
+
+/* Returns the number of block groups, each of which is one sector of
+   the free map file. */
+size_t
+free_map_group_cnt (void)
+{
+  return group_cnt;
+}
+
+/* Opens the free map file.  If GROUP_FREE holds the free sector
+   count of each of the GROUP_CNT block groups, as saved by
+   free_map_summary() at a clean shutdown, the bits of each group are
+   read when first used.  Otherwise the whole free map is read now. */
+void
+free_map_open (const uint32_t *group_free, size_t cnt) 
+{
+  size_t i;
+
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  if (group_free != NULL && cnt == group_cnt)
+    {
+      free_cnt = 0;
+      for (i = 0; i < group_cnt; i++)
+        {
+          groups[i].free_cnt = group_free[i];
+          groups[i].dirty = false;
+          groups[i].loaded = false;
+          free_cnt += group_free[i];
+        }
+      return;
+    }
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Stores the free sector count of each block group into GROUP_FREE,
+   which has room for MAX counts, for free_map_open() at the next boot.
+   Returns the number of groups, or 0 if there are more than MAX. */
+size_t
+free_map_summary (uint32_t *group_free, size_t max)
+{
+  size_t i;
+
+  if (group_cnt > max)
+    return 0;
+  for (i = 0; i < group_cnt; i++)
+    group_free[i] = groups[i].free_cnt;
+  return group_cnt;
+}
+
+/* Writes the free map to disk and closes the free map file.
+   Later commits leave the free map alone. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_flush ();
+  lock_acquire (&flush_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&flush_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,10 +444,12 @@ free_map_create (void)
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), 0))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  The write allocates the sectors of the
+     file, which is empty yet, and free_map_flush() records them. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  free_map_flush ();
 }
@@ -3,15 +3,25 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "devices/disk.h"
 
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
-void free_map_open (void);
+void free_map_open (const uint32_t *group_free, size_t group_cnt);
+size_t free_map_summary (uint32_t *group_free, size_t max);
 void free_map_close (void);
+void free_map_flush (void);
+void free_map_write (void);
+size_t free_map_group_cnt (void);
 
-bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate_run (disk_sector_t goal, size_t cnt,
+                            disk_sector_t *, size_t *);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+bool free_map_allocate_reserved (disk_sector_t goal, size_t cnt,
+                                 disk_sector_t *, size_t *);
 void free_map_release (disk_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
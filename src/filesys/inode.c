@@ -1,10 +1,15 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
+#include <limits.h>
 #include <round.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 #include "filesys/cache.h"
 
@@ -14,12 +19,29 @@
 /* 8MB-sizeof(struct inode_disk) */
 #define MAX_FILE_SIZE 8388096
 
-/* number of pointers on indirect block is (512B/4B)=128 */
-//define NUM_PTRS_INDIRECT_BLOCK 128
+/* A run of COUNT contiguous disk sectors starting at START, holding
+   file sectors LOGICAL through LOGICAL + COUNT - 1. */
+struct extent
+  {
+    uint32_t logical;                   /* First file sector of the run. */
+    disk_sector_t start;                /* First disk sector of the run. */
+    uint32_t count;                     /* Number of sectors in the run. */
+  };
+
+/* most sectors asked from the free map at once */
+#define GROW_MAX_RUN 128
+
+/* number of extents kept in the inode itself and on each overflow block */
+#define INODE_EXTENTS 39
+#define EXTENT_BLOCK_EXTENTS 42
 
-//#define NUM_DIRECT_BLOCKS 1
-//#define NUM_INDIRECT_BLOCKS 1
-//#define NUM_DOUBLY_INDIRECT_BLOCKS 1
+/* Inline inodes.
+   A file or directory of at most INLINE_MAX bytes keeps its data in
+   the inode sector, where the extents would be, so that it costs no
+   sector of its own and is read along with its inode.  It moves to a
+   data sector when it grows past INLINE_MAX. */
+#define INLINE_MAX 468                  /* INODE_EXTENTS extents. */
+#define INODE_INLINE 0x1                /* Flag of struct inode_disk. */
 
 /* On-disk inode.
    Must be exactly DISK_SECTOR_SIZE bytes long. */
@@ -29,14 +51,28 @@ struct inode_disk
     int is_dir;                         
     disk_sector_t parent;
 
-    /* for extensible file implementation */
-    disk_sector_t direct_ptr;           /* points data sector */
-    disk_sector_t indirect_ptr;         /* points sector pointing data sector */
-    disk_sector_t doubly_indirect_ptr;  /* points sector pointing sector pointing data sector */
-    
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[121];               /* Not used. */
+
+    /* for extensible file implementation */
+    uint32_t extent_cnt;                /* total number of extents */
+    disk_sector_t extent_block;         /* first overflow extent block, 0 if none */
+    union
+      {
+        struct extent extents[INODE_EXTENTS]; /* first extents, sorted by logical */
+        uint8_t data[INLINE_MAX];       /* file data, if INODE_INLINE */
+      };
+    uint32_t flags;                     /* INODE_INLINE or 0. */
+    uint32_t unused[4];                 /* Not used. */
+  };
+
+/* Overflow block holding the extents that do not fit in the inode.
+   Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    disk_sector_t next;                 /* next overflow block, 0 if none */
+    uint32_t extent_cnt;                /* number of extents used below */
+    struct extent extents[EXTENT_BLOCK_EXTENTS];
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -50,18 +86,29 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in inode_table. */
+    struct list_elem elem;              /* Element in closed_inodes. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Being read by its first opener. */
+    bool closing;                       /* Being written back by the last close. */
+    bool dirty;                         /* On-disk inode is out of date. */
+    bool is_inline;                     /* Data is in the inode sector. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     off_t length;                       /* file size in bytes */
     off_t read_length;
 
-    /* pointers to blocks */
-    disk_sector_t direct_ptr;
-    disk_sector_t indirect_ptr;
-    disk_sector_t doubly_indirect_ptr;
+    /* all extents of the file, sorted by logical sector */
+    struct extent *extents;
+    size_t extent_cnt;
+    size_t extent_cap;                  /* allocated slots in extents */
+    disk_sector_t *extent_blocks;       /* overflow blocks on disk */
+    size_t extent_block_cnt;
+    size_t stored_block_cnt;            /* overflow blocks on disk when last stored */
+    size_t first_changed;               /* first extent changed since then */
+    size_t spare_cnt;                   /* reserved for overflow blocks */
+    struct lock extent_lock;            /* protects the fields above */
 
     /* for subdirectory implementation */
     int is_dir;
@@ -71,61 +118,412 @@ struct inode
     struct lock lock;
   };
 
+/* Returns CACHE_JOURNAL if the data of INODE is metadata, which goes
+   through the journal, that is, for directories and the free map. */
+static int
+journal_flag (const struct inode *inode)
+{
+  return inode->is_dir || inode->sector == FREE_MAP_SECTOR ? CACHE_JOURNAL : 0;
+}
+
+/* Sets up an empty extent list for INODE. */
+static void
+extents_init (struct inode *inode)
+{
+  inode->extents = NULL;
+  inode->extent_cnt = inode->extent_cap = 0;
+  inode->extent_blocks = NULL;
+  inode->extent_block_cnt = inode->spare_cnt = 0;
+  inode->stored_block_cnt = 0;
+  inode->first_changed = SIZE_MAX;
+  lock_init (&inode->extent_lock);
+}
+
+/* Frees INODE's in-memory extent list. */
+static void
+extents_destroy (struct inode *inode)
+{
+  free (inode->extents);
+  free (inode->extent_blocks);
+}
+
+/* Makes room for at least CNT extents in INODE.
+   Returns false if memory allocation fails. */
+static bool
+extents_reserve (struct inode *inode, size_t cnt)
+{
+  struct extent *extents;
+  size_t cap;
+
+  if (cnt <= inode->extent_cap)
+    return true;
+  cap = inode->extent_cap ? inode->extent_cap * 2 : INODE_EXTENTS;
+  while (cap < cnt)
+    cap *= 2;
+  extents = realloc (inode->extents, cap * sizeof *extents);
+  if (extents == NULL)
+    return false;
+  inode->extents = extents;
+  inode->extent_cap = cap;
+  return true;
+}
+
+/* Loads INODE's extents from DATA and its overflow blocks.
+   Returns false if memory allocation fails. */
+static bool
+extents_load (struct inode *inode, const struct inode_disk *data)
+{
+  struct extent_block block;
+  disk_sector_t next = data->extent_block;
+  size_t cnt = data->extent_cnt < INODE_EXTENTS ? data->extent_cnt : INODE_EXTENTS;
+
+  if (!extents_reserve (inode, data->extent_cnt))
+    return false;
+  memcpy (inode->extents, data->extents, cnt * sizeof *inode->extents);
+  inode->extent_cnt = cnt;
+
+  while (next != 0)
+    {
+      disk_sector_t *blocks = realloc (inode->extent_blocks,
+                                       (inode->extent_block_cnt + 1) * sizeof *blocks);
+      if (blocks == NULL)
+        return false;
+      inode->extent_blocks = blocks;
+      blocks[inode->extent_block_cnt++] = next;
+
+      cache_read (next, &block, 0, DISK_SECTOR_SIZE);
+      ASSERT (inode->extent_cnt + block.extent_cnt <= data->extent_cnt);
+      memcpy (inode->extents + inode->extent_cnt, block.extents,
+              block.extent_cnt * sizeof *inode->extents);
+      inode->extent_cnt += block.extent_cnt;
+      next = block.next;
+    }
+  inode->stored_block_cnt = inode->extent_block_cnt;
+  return true;
+}
+
+/* Returns the number of extents INODE has room for on disk. */
+static size_t
+extents_capacity (const struct inode *inode)
+{
+  return INODE_EXTENTS + inode->extent_block_cnt * EXTENT_BLOCK_EXTENTS;
+}
+
+/* Adds an overflow block to INODE, taken from its spare sectors if
+   SPARE is true and allocated near it otherwise.
+   Must be called with INODE's extent_lock held.
+   Returns false if the disk or memory runs out. */
+static bool
+extents_add_block (struct inode *inode, bool spare)
+{
+  disk_sector_t *blocks;
+  size_t got;
+  bool success;
+
+  blocks = realloc (inode->extent_blocks,
+                    (inode->extent_block_cnt + 1) * sizeof *blocks);
+  if (blocks == NULL)
+    return false;
+  inode->extent_blocks = blocks;
+  if (spare)
+    success = free_map_allocate_reserved (inode->sector, 1,
+                                          &blocks[inode->extent_block_cnt], &got);
+  else
+    success = free_map_allocate_run (inode->sector, 1,
+                                     &blocks[inode->extent_block_cnt], &got);
+  if (!success)
+    return false;
+  if (spare)
+    inode->spare_cnt--;
+  inode->extent_block_cnt++;
+  inode->dirty = true;
+  return true;
+}
+
+/* Returns the first of NEEDED overflow blocks of INODE that differs
+   from disk: the one with the first extent changed since the last
+   store, or the last one if the number of blocks changed, as its link
+   did too. */
+static size_t
+extents_changed_block (const struct inode *inode, size_t needed)
+{
+  size_t from = SIZE_MAX;
+  size_t last;
+
+  if (inode->first_changed != SIZE_MAX)
+    from = inode->first_changed < INODE_EXTENTS
+           ? 0 : (inode->first_changed - INODE_EXTENTS) / EXTENT_BLOCK_EXTENTS;
+  if (needed != inode->stored_block_cnt)
+    {
+      last = needed < inode->stored_block_cnt ? needed : inode->stored_block_cnt;
+      last = last > 0 ? last - 1 : 0;
+      if (last < from)
+        from = last;
+    }
+  return from;
+}
+
+/* Stores INODE's extents into DATA, writing the ones that do not fit
+   there to overflow blocks.  Only the blocks that changed since the
+   last store are written.  The blocks were added along with the
+   extents, and those no longer needed are released. */
+static void
+extents_store (struct inode *inode, struct inode_disk *data)
+{
+  struct extent_block block;
+  size_t cnt = inode->extent_cnt < INODE_EXTENTS ? inode->extent_cnt : INODE_EXTENTS;
+  size_t overflow = inode->extent_cnt - cnt;
+  size_t needed = DIV_ROUND_UP (overflow, EXTENT_BLOCK_EXTENTS);
+  size_t from = extents_changed_block (inode, needed);
+  size_t i;
+
+  ASSERT (needed <= inode->extent_block_cnt);
+  for (; inode->extent_block_cnt > needed; inode->extent_block_cnt--)
+    free_map_release (inode->extent_blocks[inode->extent_block_cnt - 1], 1);
+
+  data->extent_cnt = inode->extent_cnt;
+  data->extent_block = needed > 0 ? inode->extent_blocks[0] : 0;
+  memcpy (data->extents, inode->extents, cnt * sizeof *data->extents);
+
+  for (i = from; i < needed; i++)
+    {
+      size_t ofs = INODE_EXTENTS + i * EXTENT_BLOCK_EXTENTS;
+      memset (&block, 0, sizeof block);
+      block.next = i + 1 < needed ? inode->extent_blocks[i + 1] : 0;
+      block.extent_cnt = inode->extent_cnt - ofs < EXTENT_BLOCK_EXTENTS
+                         ? inode->extent_cnt - ofs : EXTENT_BLOCK_EXTENTS;
+      memcpy (block.extents, inode->extents + ofs,
+              block.extent_cnt * sizeof *block.extents);
+      cache_write_journal (inode->extent_blocks[i], &block, 0, DISK_SECTOR_SIZE);
+    }
+  inode->stored_block_cnt = needed;
+  inode->first_changed = SIZE_MAX;
+}
+
+/* Returns the number of INODE's extents that start at or before
+   file sector SECTOR, by binary search.
+   Must be called with INODE's extent_lock held. */
+static size_t
+find_extent (const struct inode *inode, uint32_t sector)
+{
+  size_t lo = 0, hi = inode->extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (inode->extents[mid].logical <= sector)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Maps COUNT file sectors from LOGICAL, which must be a hole, onto
+   disk sectors from START.  The run is merged into its neighbors
+   when it continues them both in the file and on disk.  A new extent
+   that does not fit the overflow blocks gets another one.
+   Must be called with INODE's extent_lock held.
+   Returns false if the disk or memory runs out. */
+static bool
+extent_insert (struct inode *inode, uint32_t logical, disk_sector_t start,
+               uint32_t count)
+{
+  size_t pos = find_extent (inode, logical);
+  struct extent *prev = pos > 0 ? &inode->extents[pos - 1] : NULL;
+  struct extent *next = pos < inode->extent_cnt ? &inode->extents[pos] : NULL;
+  bool merge_prev, merge_next;
+
+  ASSERT (prev == NULL || prev->logical + prev->count <= logical);
+  ASSERT (next == NULL || logical + count <= next->logical);
+  inode->dirty = true;
+  merge_prev = prev != NULL && prev->logical + prev->count == logical
+               && prev->start + prev->count == start;
+  merge_next = next != NULL && logical + count == next->logical
+               && start + count == next->start;
+  if ((merge_prev ? pos - 1 : pos) < inode->first_changed)
+    inode->first_changed = merge_prev ? pos - 1 : pos;
+
+  if (merge_prev && merge_next)
+    {
+      prev->count += count + next->count;
+      memmove (next, next + 1,
+               (inode->extent_cnt - pos - 1) * sizeof *inode->extents);
+      inode->extent_cnt--;
+    }
+  else if (merge_prev)
+    prev->count += count;
+  else if (merge_next)
+    {
+      next->logical = logical;
+      next->start = start;
+      next->count += count;
+    }
+  else
+    {
+      struct extent *e;
+      if (inode->extent_cnt == extents_capacity (inode)
+          && !extents_add_block (inode, false))
+        return false;
+      if (!extents_reserve (inode, inode->extent_cnt + 1))
+        return false;
+      e = &inode->extents[pos];
+      memmove (e + 1, e, (inode->extent_cnt - pos) * sizeof *e);
+      e->logical = logical;
+      e->start = start;
+      e->count = count;
+      inode->extent_cnt++;
+    }
+  return true;
+}
+
+/* Same as extent_insert(), but acquires INODE's extent_lock itself. */
+static bool
+extent_add (struct inode *inode, uint32_t logical, disk_sector_t start,
+            uint32_t count)
+{
+  bool success;
+
+  lock_acquire (&inode->extent_lock);
+  success = extent_insert (inode, logical, start, count);
+  lock_release (&inode->extent_lock);
+  return success;
+}
+
+/* Returns the disk sector that holds file sector SECTOR of INODE,
+   or -1 if SECTOR is in a hole.
+   Must be called with INODE's extent_lock held. */
+static disk_sector_t
+lookup_sector (const struct inode *inode, uint32_t sector)
+{
+  size_t pos = find_extent (inode, sector);
+
+  if (pos > 0)
+    {
+      const struct extent *e = &inode->extents[pos - 1];
+      if (sector < e->logical + e->count)
+        return e->start + (sector - e->logical);
+    }
+  return -1;
+}
+
 /* Returns the disk sector that contains byte offset POS within
    INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, or if POS is in a hole. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos, off_t length) 
+byte_to_sector (struct inode *inode, off_t pos, off_t length) 
 {
   ASSERT (inode != NULL);
-  uint32_t index;
-  disk_sector_t indirect_buffer[128];
+  disk_sector_t result;
 
   if (pos >= length)
     return -1;
 
-  /* on data sector pointed by direct block */
-  if (pos < DISK_SECTOR_SIZE){
-    return inode->direct_ptr;
-  }
-  
-  /* on data sector pointed by indirect block */
-  else if(pos < DISK_SECTOR_SIZE*129){
-    disk_read(filesys_disk, inode->indirect_ptr, &indirect_buffer);
-    pos -= DISK_SECTOR_SIZE;            /* subtract data offset of 'direct block' */
-    index = pos/DISK_SECTOR_SIZE;       /* index among 128 pointers on 'pointer block' */
-    return indirect_buffer[index];
-  }
-  
-  /* on data sector pointed by doubly indirect block */
-  else{
-    disk_read(filesys_disk, inode->doubly_indirect_ptr, &indirect_buffer);
-    pos -= DISK_SECTOR_SIZE*129;        /* subtract data offset of 'direct block' and 'indirect block' */
-    index = pos/(DISK_SECTOR_SIZE*128); /* index among 128 pointers on 'pointer-of-pointer block' */
-    disk_read(filesys_disk, indirect_buffer[index], &indirect_buffer);
-    pos -= index*DISK_SECTOR_SIZE*128;  /* consider some of data sectors pointed by 'doubly indirect block' */
-    index = pos/DISK_SECTOR_SIZE;       /* index among 128 pointers on 'pointer block' */
-    return indirect_buffer[index];
-  }
+  lock_acquire (&inode->extent_lock);
+  result = lookup_sector (inode, pos / DISK_SECTOR_SIZE);
+  lock_release (&inode->extent_lock);
+  return result;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns the cache line, got with MODE, holding byte offset POS of
+   INODE, which must be below INODE's length.
+   Returns a null pointer if POS is in a hole, which reads as zeros.
+   A delayed sector is looked up and got with extent_lock held, so
+   that inode_allocate_delayed() cannot move it to a real sector in
+   between. */
+static struct cache_line *
+get_inode_line (struct inode *inode, off_t pos, int mode)
+{
+  struct cache_line *cl;
+  disk_sector_t sector;
+
+  lock_acquire (&inode->extent_lock);
+  sector = lookup_sector (inode, pos / DISK_SECTOR_SIZE);
+  if (sector == (disk_sector_t) -1)
+    cl = NULL;
+  else if (cache_delayed (sector))
+    {
+      cl = get_cache_line (sector, mode);
+    }
+  else
+    {
+      lock_release (&inode->extent_lock);
+      return get_cache_line (sector, mode);
+    }
+  lock_release (&inode->extent_lock);
+  return cl;
+}
+
+/* Table of in-memory inodes by sector, so that opening a single inode
+   twice returns the same `struct inode'.
+   Besides the open inodes it keeps up to INODE_CACHE_SIZE inodes whose
+   last opener has closed them, after they have been written back.  They
+   are on closed_inodes, least recently closed first, and are revived by
+   inode_open() without reading the disk.  An inode is put in the table
+   `loading' by its first opener, which reads it without holding
+   inode_table_lock, and an inode still being written back by its last
+   close is `closing'.  Other openers wait for either on inode_ready. */
+#define INODE_CACHE_SIZE 64
+
+static struct hash inode_table;
+static struct list closed_inodes;
+static size_t closed_cnt;               /* Length of closed_inodes. */
+static struct lock inode_table_lock;    /* Protects the above and open_cnt. */
+static struct condition inode_ready;
+
+/* Delayed allocation.
+   A file grown by a write gets sectors numbered from CACHE_DELAYED_BASE,
+   which live only in the buffer cache.  They are given real sectors in
+   long runs by inode_allocate_delayed(), when the file is closed, by the
+   periodic writer, or when too many are delayed.  Free space for them is
+   reserved in the free map beforehand. */
+static size_t delayed_cnt;              /* Delayed sectors of all inodes. */
+static disk_sector_t next_delayed;      /* Next unused delayed sector. */
+static struct lock delayed_lock;        /* Protects the two above. */
+
+/* Limit of delayed_cnt.  Dirty delayed lines cannot be evicted, nor
+   can the lines held by a journal transaction, up to a quarter of the
+   cache, so at least half of the cache stays evictable. */
+#define DELAYED_MAX (buffer_cache_capacity / 4)
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&inode_table, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init (&inode_table_lock);
+  cond_init (&inode_ready);
+  delayed_cnt = 0;
+  next_delayed = CACHE_DELAYED_BASE;
+  lock_init (&delayed_lock);
 }
 
-void inode_grow(struct inode *inode, off_t new_length);
+static bool inode_mapped(struct inode *inode, off_t offset, off_t size);
+static off_t inode_fill(struct inode *inode, off_t offset, off_t size);
+static bool inode_migrate(struct inode *inode);
+static void inode_free(struct inode *inode);
+static void inode_destroy (struct inode *);
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   disk.
+   disk.  The data is a hole until it is written.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -141,6 +539,7 @@ inode_create (disk_sector_t sector, off_t length, int is_dir)
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == DISK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
@@ -149,15 +548,10 @@ inode_create (disk_sector_t sector, off_t length, int is_dir)
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_dir = is_dir;
       disk_inode->parent = ROOT_DIR_SECTOR;
-
-      struct inode i;
-      i.length = 0;
-      inode_grow(&i, length);
-      disk_inode->direct_ptr = i.direct_ptr;
-      disk_inode->indirect_ptr = i.indirect_ptr;
-      disk_inode->doubly_indirect_ptr = i.doubly_indirect_ptr;
-     
-      disk_write(filesys_disk, sector, disk_inode);
+      /* the free map is written by sectors, so it never goes inline */
+      if (length <= INLINE_MAX && sector != FREE_MAP_SECTOR)
+        disk_inode->flags = INODE_INLINE;
+      cache_write_journal (sector, disk_inode, 0, DISK_SECTOR_SIZE);
       success = true;
 
       free(disk_inode);
@@ -171,42 +565,75 @@ inode_create (disk_sector_t sector, off_t length, int is_dir)
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
   struct inode_disk data;
+  bool success;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open or cached. */
+  key.sector = sector;
+  lock_acquire (&inode_table_lock);
+  while ((e = hash_find (&inode_table, &key.hash_elem)) != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->loading || inode->closing)
         {
-          inode_reopen (inode);
-          return inode; 
+          /* wait for the first open or the last close to finish,
+             then look again */
+          cond_wait (&inode_ready, &inode_table_lock);
+          continue;
         }
+      if (inode->open_cnt++ == 0)
+        {
+          list_remove (&inode->elem);
+          closed_cnt--;
+        }
+      lock_release (&inode_table_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, and claim the sector while it is read. */
   inode->sector = sector;
   inode->open_cnt = 1;
+  inode->loading = true;
+  inode->closing = false;
+  hash_insert (&inode_table, &inode->hash_elem);
+  lock_release (&inode_table_lock);
+
+  inode->dirty = false;
   inode->deny_write_cnt = 0;
   inode->removed = false;
   lock_init(&inode->lock);
-  disk_read (filesys_disk, inode->sector, &data);
+  extents_init(inode);
+  cache_read (inode->sector, &data, 0, DISK_SECTOR_SIZE);
+  success = extents_load (inode, &data);
   inode->length = data.length;
   inode->read_length = data.length;
-  inode->direct_ptr = data.direct_ptr;
-  inode->indirect_ptr = data.indirect_ptr;
-  inode->doubly_indirect_ptr = data.doubly_indirect_ptr;
   inode->is_dir = data.is_dir;
   inode->parent = data.parent;
+  inode->is_inline = (data.flags & INODE_INLINE) != 0;
+
+  /* publish it, or give the sector up to the next opener */
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  if (!success)
+    hash_delete (&inode_table, &inode->hash_elem);
+  cond_broadcast (&inode_ready, &inode_table_lock);
+  lock_release (&inode_table_lock);
+  if (!success)
+    {
+      inode_destroy (inode);
+      return NULL;
+    }
   return inode;
 }
 
@@ -215,7 +642,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -226,43 +657,151 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-void inode_free(struct inode *inode);
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Frees the memory of INODE, which is no longer in inode_table. */
+static void
+inode_destroy (struct inode *inode)
+{
+  extents_destroy (inode);
+  free (inode);
+}
+
+/* Returns true if the last close of INODE has to change something
+   on disk, that is, if it is removed, changed, or has delayed sectors. */
+static bool
+needs_write_back (struct inode *inode)
+{
+  bool needed = inode->removed || inode->dirty;
+  size_t i;
+
+  lock_acquire (&inode->extent_lock);
+  for (i = 0; i < inode->extent_cnt && !needed; i++)
+    needed = cache_delayed (inode->extents[i].start);
+  lock_release (&inode->extent_lock);
+  return needed;
+}
+
+/* Returns the number of journal credits a write-back of INODE may
+   use: the inode, its overflow blocks that changed, and one more block
+   in case the extents grow before then, which relinks the last block.
+   Delayed sectors rebuild the whole extent list when allocated.
+   A directory has its extents written back as it grows, so it needs
+   at most the inode, its last block and a new one. */
+size_t
+inode_journal_credits (struct inode *inode)
+{
+  size_t cnt, from, i;
+
+  lock_acquire (&inode->extent_lock);
+  cnt = inode->extent_block_cnt;
+  from = extents_changed_block (inode, cnt);
+  if (cnt > 0 && from > cnt - 1)
+    from = cnt - 1;
+  for (i = 0; i < inode->extent_cnt && from > 0; i++)
+    if (cache_delayed (inode->extents[i].start))
+      from = 0;
+  lock_release (&inode->extent_lock);
+  return 2 + (from < cnt ? cnt - from : 0);
+}
+
+/* Writes INODE back to its sector, with the extents that changed. */
+static void
+inode_write_back (struct inode *inode)
+{
+  struct inode_disk disk_inode;
+
+  /* inline data is written in place, keep it */
+  if (inode->is_inline)
+    cache_read (inode->sector, &disk_inode, 0, DISK_SECTOR_SIZE);
+  else
+    memset (&disk_inode, 0, sizeof disk_inode);
+  disk_inode.length = inode->length;
+  disk_inode.magic = INODE_MAGIC;
+  extents_store (inode, &disk_inode);
+  disk_inode.is_dir = inode->is_dir;
+  disk_inode.parent = inode->parent;
+  disk_inode.flags = inode->is_inline ? INODE_INLINE : 0;
+  cache_write_journal (inode->sector, &disk_inode, 0, DISK_SECTOR_SIZE);
+  inode->dirty = false;
+}
+
+/* Closes INODE and writes it back if it changed.
+   If this was the last reference to INODE, keeps it in the inode
+   cache, evicting the least recently closed inode if the cache is full.
+   If INODE was also a removed inode, frees its blocks and memory.
+   A last close that changes something on disk opens a journal handle,
+   before INODE is marked closing, since an opener waits for a closing
+   inode with locks that a running transaction may need.  An inode
+   whose extents are too many for the journal is written back without
+   it, like file data. */
 void
 inode_close (struct inode *inode) 
 {
+  struct inode *victim = NULL;
+  bool journaled = false;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&inode_table_lock);
+  while (inode->open_cnt == 1 && !journaled && needs_write_back (inode))
+    {
+      lock_release (&inode_table_lock);
+      journaled = journal_begin (inode->removed
+                                 ? 0 : inode_journal_credits (inode));
+      lock_acquire (&inode_table_lock);
+      if (!journaled)
+        break;
+    }
+  last = --inode->open_cnt == 0;
+  if (last && inode->removed)
+    hash_delete (&inode_table, &inode->hash_elem);
+  else if (last)
+    inode->closing = true;
+  lock_release (&inode_table_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
           inode_free(inode); 
+          inode_destroy (inode);
+          if (journaled)
+            journal_end ();
+          return;
         }
-      /* writeback needed */
-      else{
-        struct inode_disk disk_inode;
-        disk_inode.length = inode->length;
-        disk_inode.magic = INODE_MAGIC;
-        disk_inode.direct_ptr = inode->direct_ptr;
-        disk_inode.indirect_ptr = inode->indirect_ptr;
-        disk_inode.doubly_indirect_ptr = inode->doubly_indirect_ptr;
-        disk_inode.is_dir = inode->is_dir;
-        disk_inode.parent = inode->parent;
-        disk_write(filesys_disk, inode->sector, &disk_inode);
-      }
-      free (inode); 
+      /* writeback needed, unless nothing changed since it was read */
+      inode_allocate_delayed(inode);
+      if(inode->dirty)
+        inode_write_back(inode);
+
+      /* sectors allocated above are committed with the inode */
+      if (journaled)
+        journal_end ();
+      journaled = false;
+
+      /* now clean, it goes to the inode cache */
+      lock_acquire (&inode_table_lock);
+      inode->closing = false;
+      list_push_back (&closed_inodes, &inode->elem);
+      if (++closed_cnt > INODE_CACHE_SIZE)
+        {
+          victim = list_entry (list_pop_front (&closed_inodes),
+                               struct inode, elem);
+          hash_delete (&inode_table, &victim->hash_elem);
+          closed_cnt--;
+        }
+      cond_broadcast (&inode_ready, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      if (victim != NULL)
+        inode_destroy (victim);
     }
+  if (journaled)
+    journal_end ();
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -283,13 +822,20 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   
-  if(offset >= inode->read_length)  
+  if(offset < 0 || size < 0 || offset >= inode->read_length)
     return 0;
 
+  if(inode->is_inline){
+    if(size > inode->read_length - offset)
+      size = inode->read_length - offset;
+    cache_read(inode->sector, buffer,
+               offsetof(struct inode_disk, data) + offset, size);
+    return size;
+  }
+
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector (inode, offset, inode->read_length);
+      /* Starting byte offset within sector. */
       int sector_ofs = offset % DISK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -302,14 +848,14 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      /* read-ahead */
-      disk_sector_t next_sector_idx = byte_to_sector (inode, offset+chunk_size, inode->read_length);
-      if(next_sector_idx != -1)
-        read_ahead_put(next_sector_idx);
-
-      struct cache_line *cl = get_cache_line(sector_idx, 0);
-      memcpy(buffer + bytes_read, (uint8_t *) &cl->block + sector_ofs, chunk_size);
-      /* end of accessing the cache line */
+      struct cache_line *cl = get_inode_line(inode, offset, CACHE_READ);
+      if(cl == NULL)/* hole */
+        memset(buffer + bytes_read, 0, chunk_size);
+      else{
+        memcpy(buffer + bytes_read, cl->block + sector_ofs, chunk_size);
+        /* end of accessing the cache line */
+        release_cache_line(cl);
+      }
 
       /* Advance. */
       size -= chunk_size;
@@ -320,6 +866,27 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* Queues sectors holding SIZE bytes of INODE from OFFSET for read-ahead.
+   Sectors beyond end of file and holes are ignored. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+  disk_sector_t sector;
+
+  if (inode->is_inline)
+    return;
+  if (end > inode->read_length)
+    end = inode->read_length;
+  offset -= offset % DISK_SECTOR_SIZE;
+  for (; offset < end; offset += DISK_SECTOR_SIZE)
+    {
+      sector = byte_to_sector (inode, offset, inode->read_length);
+      if (sector != (disk_sector_t) -1)
+        read_ahead_put (sector);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -334,20 +901,50 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
   if (inode->deny_write_cnt)
     return 0;
+  /* the end must be a valid offset, whatever a seek has set */
+  if (offset < 0 || size < 0)
+    return 0;
+  if (size > INT_MAX - offset)
+    size = INT_MAX - offset;
 
-  /* beyond EOF, file grow needed */
-  if(offset + size > inode->length){
+  /* holes in the range, or beyond EOF. sectors need allocation.
+     on failure, writes up to the last allocated sector */
+  if(size > 0 && (inode->is_inline || offset + size > inode->length
+                   || !inode_mapped(inode, offset, size))){
     if(!inode->is_dir)
       lock_acquire(&inode->lock);
-    inode_grow(inode, offset+size);
+    if(inode->is_inline && offset + size > INLINE_MAX && !inode_migrate(inode))
+      size = 0;
+    if(inode->is_inline){
+      /* still fits in the inode sector */
+      if(size > 0 && journal_flag(inode))
+        cache_write_journal(inode->sector, buffer,
+                            offsetof(struct inode_disk, data) + offset, size);
+      else if(size > 0)
+        cache_write(inode->sector, buffer,
+                    offsetof(struct inode_disk, data) + offset, size);
+      bytes_written = size;
+    }
+    else
+      size = inode_fill(inode, offset, size);
+    /* nothing written, as when migration failed, extends nothing */
+    if(size > 0 && offset + size > inode->length){
+      inode->length = offset + size;
+      inode->dirty = true;
+    }
+    ASSERT(!inode->is_inline || inode->length <= INLINE_MAX);
+    if(inode->is_inline)
+      size = 0;
+    /* metadata commits with the extents and length that reach it */
+    if(journal_flag(inode) && inode->dirty)
+      inode_write_back(inode);
     if(!inode->is_dir)
       lock_release(&inode->lock);
   }
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      disk_sector_t sector_idx = byte_to_sector (inode, offset,inode->length);
+      /* Starting byte offset within sector. */
       int sector_ofs = offset % DISK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -360,9 +957,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      struct cache_line *cl = get_cache_line(sector_idx, 1);
-      memcpy ((uint8_t *) &cl->block + sector_ofs, buffer + bytes_written, chunk_size);
+      /* no need to read the sector if it is overwritten entirely */
+      struct cache_line *cl = get_inode_line(inode, offset, (chunk_size == DISK_SECTOR_SIZE
+                                                             ? CACHE_OVERWRITE : CACHE_WRITE)
+                                                            | journal_flag(inode));
+      memcpy (cl->block + sector_ofs, buffer + bytes_written, chunk_size);
       /* end of accessing the cache line */
+      release_cache_line(cl);
 
       /* Advance. */
       size -= chunk_size;
@@ -402,122 +1003,295 @@ inode_length (const struct inode *inode)
 }
 
 /////////* newly made functions for project4 *////////////
-void inode_grow(struct inode *inode, off_t new_length){
-  static uint8_t zeros[DISK_SECTOR_SIZE];
-  size_t old_sectors = bytes_to_sectors(inode->length);
-  size_t sectors_to_add = bytes_to_sectors(new_length) - old_sectors;
-  disk_sector_t indirect_buffer[128];
-  disk_sector_t indirect_buffer2[128];
-  uint32_t index;
-  uint32_t index2;
-
-  if(sectors_to_add == 0){
-    inode->length = new_length;
-    return;
-  }
+/* takes COUNT delayed sectors, and reserves as many free sectors for
+   them plus SPARE more. stores the first delayed sector into *START.
+   returns false if DELAYED_MAX or the free space would be exceeded. */
+static bool delayed_get(size_t count, size_t spare, disk_sector_t *start){
+  bool success = false;
 
-  /* case1. if inode->direct_ptr is not full */
-  if(old_sectors == 0){
-    free_map_allocate(1, &inode->direct_ptr);
-    disk_write(filesys_disk, inode->direct_ptr, zeros);
-    sectors_to_add --;
-    old_sectors ++;
-    if(sectors_to_add == 0){
-      inode->length = new_length;
-      return;
-    }
+  lock_acquire(&delayed_lock);
+  if(delayed_cnt + count <= DELAYED_MAX && free_map_reserve(count + spare)){
+    delayed_cnt += count;
+    *start = next_delayed;
+    next_delayed += count;
+    success = true;
   }
+  lock_release(&delayed_lock);
+  return success;
+}
 
-  /* case2. if inode->indirect_ptr is not full */
-  if(old_sectors == 1)/* inode->indirect_ptr is not allocated */
-    free_map_allocate(1, &inode->indirect_ptr);
+/* COUNT delayed sectors have got real sectors, or have been dropped */
+static void delayed_put(size_t count){
+  lock_acquire(&delayed_lock);
+  ASSERT(delayed_cnt >= count);
+  delayed_cnt -= count;
+  lock_release(&delayed_lock);
+}
+
+/* allocates COUNT sectors from file sector LOGICAL of INODE at once, in
+   runs continuing the preceding extent on disk when possible. the new
+   sectors are zeroed in the cache, for partial writes into them.
+   returns false if the disk or memory runs out. */
+static bool fill_now(struct inode *inode, uint32_t logical, size_t count){
+  disk_sector_t goal, sector;
+  size_t pos, cnt, i;
+
+  /* the first data sector goes near the inode itself */
+  lock_acquire(&inode->extent_lock);
+  pos = find_extent(inode, logical);
+  if(pos > 0){
+    struct extent *prev = &inode->extents[pos - 1];
+    goal = prev->start + prev->count;
+  }
   else
-    disk_read(filesys_disk, inode->indirect_ptr, &indirect_buffer);
-  
-  while(old_sectors < 129){
-    index = old_sectors - 1;/* next sector index to grow */
-    free_map_allocate(1, &indirect_buffer[index]);
-    disk_write(filesys_disk, indirect_buffer[index], zeros);
-    sectors_to_add --;
-    old_sectors ++;
-    if(sectors_to_add == 0){
-      disk_write(filesys_disk, inode->indirect_ptr, &indirect_buffer);
-      inode->length = new_length;
-      return;
+    goal = inode->sector + 1;
+  lock_release(&inode->extent_lock);
+
+  for(; count > 0; count -= cnt, logical += cnt){
+    cnt = count < GROW_MAX_RUN ? count : GROW_MAX_RUN;
+    if(!free_map_allocate_run(goal, cnt, &sector, &cnt))
+      return false;
+    for(i = 0; i < cnt; i++)
+      cache_write(sector + i, NULL, 0, DISK_SECTOR_SIZE);
+    if(!extent_add(inode, logical, sector, cnt)){
+      free_map_release(sector, cnt);
+      return false;
     }
+    goal = sector + cnt;
   }
-  disk_write(filesys_disk, inode->indirect_ptr, &indirect_buffer);
+  return true;
+}
 
-  /* case3. here, inode->doubly_indirect_ptr is not full */
-  ASSERT(old_sectors <= 16513);/* 1+128+128*128 */
+/* maps COUNT sectors from file sector LOGICAL of INODE to delayed
+   sectors, so written data stays in the cache until
+   inode_allocate_delayed(). if too many sectors are delayed, INODE's own
+   delayed sectors are allocated first, and if that is not enough the
+   sectors are allocated by fill_now().
+   the extents the delayed sectors may split into when they are
+   allocated need overflow blocks, which must not fail then, so a spare
+   sector is reserved for every EXTENT_BLOCK_EXTENTS delayed sectors. */
+static bool fill_delayed(struct inode *inode, uint32_t logical, size_t count){
+  size_t spare = DIV_ROUND_UP(count, EXTENT_BLOCK_EXTENTS);
+  disk_sector_t start;
+  bool success;
+
+  if(!delayed_get(count, spare, &start)){
+    inode_allocate_delayed(inode);
+    if(!delayed_get(count, spare, &start))
+      return fill_now(inode, logical, count);
+  }
+  lock_acquire(&inode->extent_lock);
+  success = extent_insert(inode, logical, start, count);
+  if(success)
+    inode->spare_cnt += spare;
+  lock_release(&inode->extent_lock);
+  if(!success){
+    free_map_unreserve(count + spare);
+    delayed_put(count);
+  }
+  return success;
+}
 
-  if(old_sectors == 129)/* inode->doubly_indirect_ptr is not allocated */
-    free_map_allocate(1, &inode->doubly_indirect_ptr);
-  else
-    disk_read(filesys_disk, inode->doubly_indirect_ptr, &indirect_buffer);
+/* returns true if no byte of SIZE bytes from OFFSET of INODE is in a hole */
+static bool inode_mapped(struct inode *inode, off_t offset, off_t size){
+  uint32_t sector = offset / DISK_SECTOR_SIZE;
+  uint32_t end = bytes_to_sectors(offset + size);
+  bool mapped = true;
+  size_t pos;
+
+  lock_acquire(&inode->extent_lock);
+  while(sector < end){
+    pos = find_extent(inode, sector);
+    if(pos == 0 || sector >= inode->extents[pos - 1].logical + inode->extents[pos - 1].count){
+      mapped = false;
+      break;
+    }
+    sector = inode->extents[pos - 1].logical + inode->extents[pos - 1].count;
+  }
+  lock_release(&inode->extent_lock);
+  return mapped;
+}
 
-  while(1){/* while (old_sectors < 16513) */
-    index = (old_sectors - 129)/128;
-    if(old_sectors % 128 == 1)/* the pointer block is not allocated */
-      free_map_allocate(1, &indirect_buffer[index]);
-    else
-      disk_read(filesys_disk, indirect_buffer[index], &indirect_buffer2);
-    while(old_sectors < (129+(index+1)*128)){/* escape when this pointer block's data sectors = 128 */
-      index2 = ((old_sectors-129) % 128);/* next sector index to grow */
-      free_map_allocate(1, &indirect_buffer2[index2]);
-      disk_write(filesys_disk, indirect_buffer2[index2], zeros);
-      sectors_to_add --;
-      old_sectors ++;
-      if(sectors_to_add == 0){
-        disk_write(filesys_disk, indirect_buffer[index], &indirect_buffer2);
-        disk_write(filesys_disk, inode->doubly_indirect_ptr, &indirect_buffer);
-        inode->length = new_length;
-        return;
-      }
+/* allocates the holes among SIZE bytes from OFFSET of INODE. directories
+   and the free map get sectors at once, files delayed ones.
+   returns the number of bytes from OFFSET that have sectors, which is
+   less than SIZE if the disk or memory runs out. */
+static off_t inode_fill(struct inode *inode, off_t offset, off_t size){
+  uint32_t sector = offset / DISK_SECTOR_SIZE;
+  uint32_t end = bytes_to_sectors(offset + size);
+  uint32_t hole_end;
+  size_t pos;
+  bool delayed = !inode->is_dir && inode->sector != FREE_MAP_SECTOR;
+
+  while(sector < end){
+    lock_acquire(&inode->extent_lock);
+    pos = find_extent(inode, sector);
+    if(pos > 0 && sector < inode->extents[pos - 1].logical + inode->extents[pos - 1].count){
+      /* mapped already. skip to the end of the extent */
+      sector = inode->extents[pos - 1].logical + inode->extents[pos - 1].count;
+      lock_release(&inode->extent_lock);
+      continue;
+    }
+    hole_end = pos < inode->extent_cnt && inode->extents[pos].logical < end
+               ? inode->extents[pos].logical : end;
+    lock_release(&inode->extent_lock);
+
+    if(!(delayed ? fill_delayed(inode, sector, hole_end - sector)
+                 : fill_now(inode, sector, hole_end - sector))){
+      off_t filled = (off_t) sector * DISK_SECTOR_SIZE - offset;
+      return filled > 0 ? filled : 0;
+    }
+    sector = hole_end;
+  }
+  return size;
+}
+
+/* moves the inline data of INODE to a data sector of its own, before
+   it grows past INLINE_MAX. called with INODE's lock held, or with the
+   directory's for a directory.
+   returns false if the sector or memory cannot be allocated. */
+static bool inode_migrate(struct inode *inode){
+  struct cache_line *cl;
+  uint8_t *data;
+
+  if(inode->length > 0){
+    data = calloc(1, DISK_SECTOR_SIZE);
+    if(data == NULL)
+      return false;
+    cache_read(inode->sector, data, offsetof(struct inode_disk, data), inode->length);
+    if(inode_fill(inode, 0, inode->length) < inode->length){
+      free(data);
+      return false;
     }
-    disk_write(filesys_disk, indirect_buffer[index], &indirect_buffer2);
+    cl = get_inode_line(inode, 0, CACHE_OVERWRITE | journal_flag(inode));
+    memcpy(cl->block, data, DISK_SECTOR_SIZE);
+    release_cache_line(cl);
+    free(data);
   }
+  inode->is_inline = false;
+  inode->dirty = true;
+  return true;
 }
 
-void inode_free(struct inode *inode){
-  size_t sectors = bytes_to_sectors(inode->length);
-  disk_sector_t indirect_buffer[128];
-  disk_sector_t indirect_buffer2[128];
-  uint32_t index;
-  uint32_t index2;
+/* gives real sectors to the delayed sectors of INODE, in runs that
+   continue the preceding extent on disk when possible. data of the
+   delayed sectors moves to the new sectors in the cache, so nothing
+   is read or written here except sectors never written, which are zeroed.
+   the overflow blocks of the longer extent list come from INODE's spare
+   sectors, and the spares left over are given back. */
+void inode_allocate_delayed(struct inode *inode){
+  struct extent *old;
+  size_t old_cnt, i, j, done, cnt, longest;
+  disk_sector_t goal = inode->sector + 1;
+  disk_sector_t sector;
+  bool delayed = false;
+
+  lock_acquire(&inode->extent_lock);
+  longest = inode->extent_cnt;
+  for(i = 0; i < inode->extent_cnt; i++)
+    if(cache_delayed(inode->extents[i].start)){
+      longest += inode->extents[i].count - 1;
+      delayed = true;
+    }
+  if(!delayed){
+    lock_release(&inode->extent_lock);
+    return;
+  }
 
-  /* case1. if inode->direct_ptr is occupied */
-  if(sectors > 0){
-    free_map_release(inode->direct_ptr, 1);
+  /* each delayed sector may become an extent of its own */
+  while(extents_capacity(inode) < longest && inode->spare_cnt > 0)
+    if(!extents_add_block(inode, true))
+      PANIC("out of memory for extents");
+  free_map_unreserve(inode->spare_cnt);
+  inode->spare_cnt = 0;
+
+  /* rebuild the extent list, so that new runs merge with their neighbors */
+  old = inode->extents;
+  old_cnt = inode->extent_cnt;
+  inode->extents = NULL;
+  inode->extent_cnt = inode->extent_cap = 0;
+  for(i = 0; i < old_cnt; i++){
+    struct extent e = old[i];
+
+    if(!cache_delayed(e.start)){
+      if(!extent_insert(inode, e.logical, e.start, e.count))
+        PANIC("out of memory for extents");
+      goal = e.start + e.count;
+      continue;
+    }
+    for(done = 0; done < e.count; done += cnt){
+      cnt = e.count - done < GROW_MAX_RUN ? e.count - done : GROW_MAX_RUN;
+      if(!free_map_allocate_reserved(goal, cnt, &sector, &cnt))
+        PANIC("can't allocate reserved sectors");
+      for(j = 0; j < cnt; j++)
+        if(!cache_rename(e.start + done + j, sector + j))
+          cache_write(sector + j, NULL, 0, DISK_SECTOR_SIZE);
+      if(!extent_insert(inode, e.logical + done, sector, cnt))
+        PANIC("out of memory for extents");
+      goal = sector + cnt;
+    }
+    delayed_put(e.count);
   }
+  free(old);
+  lock_release(&inode->extent_lock);
+}
 
-  /* case2. if inode->indirect_ptr is occupied */
-  if(sectors > 1){
-    disk_read(filesys_disk, inode->indirect_ptr, &indirect_buffer);
-    free_map_release(inode->indirect_ptr, 1);
-    index = sectors - 2;/* current sector index that will be deallocated */
-    while(index < 0){
-      free_map_release(indirect_buffer[index], 1);
-      index --;
+/* allocates delayed sectors of every open inode.
+   closed inodes had theirs allocated by their last close.
+   the open inodes are reopened under inode_table_lock, and allocated
+   without it, so opens and closes go on meanwhile. */
+void inode_allocate_delayed_all(void){
+  struct hash_iterator i;
+  struct inode **inodes;
+  size_t cnt = 0, j;
+
+  lock_acquire(&inode_table_lock);
+  if(hash_empty(&inode_table)){
+    lock_release(&inode_table_lock);
+    return;
+  }
+  inodes = malloc(hash_size(&inode_table) * sizeof *inodes);
+  if(inodes == NULL)
+    PANIC("no space for delayed allocation");
+  hash_first(&i, &inode_table);
+  while(hash_next(&i)){
+    struct inode *inode = hash_entry(hash_cur(&i), struct inode, hash_elem);
+    if(inode->open_cnt > 0 && !inode->loading && !inode->removed){
+      inode->open_cnt++;
+      inodes[cnt++] = inode;
     }
   }
+  lock_release(&inode_table_lock);
 
-  /* case3. if inode->doubly_indirect_ptr is occupied */
-  if(sectors > 129){
-    disk_read(filesys_disk, inode->doubly_indirect_ptr, &indirect_buffer);
-    free_map_release(inode->doubly_indirect_ptr, 1);
-    index = (sectors - 129)/128;
-    while(index < 0){
-      disk_read(filesys_disk, indirect_buffer[index], &indirect_buffer2);
-      free_map_release(indirect_buffer[index], 1);
-      index2 = ((sectors - 129) % 128) - 1;/* current sector index that will be deallocated */
-      while(index2 < 0){
-        free_map_release(indirect_buffer2[index], 1);
-        index2 --;
-      }
-      index --;
+  /* the last opener may have closed one meanwhile, in which case
+     closing it here writes it back */
+  for(j = 0; j < cnt; j++){
+    inode_allocate_delayed(inodes[j]);
+    inode_close(inodes[j]);
+  }
+  free(inodes);
+}
+
+/* releases every data sector and overflow extent block of INODE.
+   delayed sectors are dropped from the cache, and their reservation ends. */
+static void inode_free(struct inode *inode){
+  size_t i, j;
+
+  for(i = 0; i < inode->extent_cnt; i++){
+    struct extent *e = &inode->extents[i];
+    if(cache_delayed(e->start)){
+      for(j = 0; j < e->count; j++)
+        cache_discard(e->start + j);
+      free_map_unreserve(e->count);
+      delayed_put(e->count);
     }
+    else
+      free_map_release(e->start, e->count);
   }
+  for(i = 0; i < inode->extent_block_cnt; i++)
+    free_map_release(inode->extent_blocks[i], 1);
+  free_map_unreserve(inode->spare_cnt);
+  inode->extent_cnt = inode->extent_block_cnt = inode->spare_cnt = 0;
 }
 
 int inode_is_dir(const struct inode *inode){
@@ -535,7 +1309,10 @@ bool inode_set_parent(disk_sector_t child_sector, struct inode *parent_inode){
   if(!(inode = inode_open(child_sector)))
     return false;
 
-  inode->parent = parent_inode->sector;
+  if(inode->parent != parent_inode->sector){
+    inode->parent = parent_inode->sector;
+    inode->dirty = true;
+  }
   inode_close(inode);
   return true;
 }
@@ -0,0 +1,405 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Metadata journal.
+   Sectors of inodes, extent blocks and directories are changed only
+   inside handles, between journal_begin() and journal_end().  A handle
+   reserves credits, the most sectors its operation may change, and
+   every handle open at the same time joins one running transaction.
+   Their cache lines are held, neither written back nor evicted, until
+   the transaction commits, which the last handle to end does.  The
+   commit adds the changed block groups of the free map, then writes a
+   record, a descriptor, copies of the sectors and a commit block, to
+   the ring at JOURNAL_SECTOR in one sequential transfer and lets the
+   lines go.  After a crash, journal_open() writes back the sectors of
+   the records found in the ring, so an operation is on disk either
+   whole or not at all, however far write-behind had got.
+
+   The ring is filled from its start.  A transaction starts only if the
+   ring has room for the biggest one, otherwise the sectors of the
+   records in it are written to their homes and the ring starts over,
+   which is a checkpoint.  journal_lock is held only to account for
+   handles and sectors, and through a commit or a checkpoint. */
+
+#define JOURNAL_MAGIC 0x4a524e4c        /* "JRNL" */
+#define DESC_MAGIC 0x4a444553           /* "JDES" */
+#define COMMIT_MAGIC 0x4a434d54         /* "JCMT" */
+
+/* The ring follows the header sector. */
+#define RING_START (JOURNAL_SECTOR + 1)
+#define RING_SECTORS (JOURNAL_SECTORS - 1)
+
+/* Most sectors of a record, as many as a descriptor has room for. */
+#define RECORD_MAX 125
+
+/* Most and fewest credits of a transaction.  The free map sectors of a
+   commit need no credits, but take room in its record. */
+#define TXN_MAX 32
+#define TXN_MIN 12
+
+/* Header of the journal, at JOURNAL_SECTOR. */
+struct journal_header
+  {
+    uint32_t magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* Sequence number of the first record. */
+    uint32_t head;                      /* Ring slot of the first record. */
+    uint32_t unused[125];
+  };
+
+/* First sector of a record, followed by the sectors' data. */
+struct journal_desc
+  {
+    uint32_t magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Sequence number of the record. */
+    uint32_t cnt;                       /* Number of sectors in the record. */
+    disk_sector_t sectors[125];         /* Home of each of them. */
+  };
+
+/* Last sector of a record.  A record without it is ignored. */
+struct journal_commit
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Same as in the descriptor. */
+    uint32_t cnt;                       /* Same as in the descriptor. */
+    uint32_t checksum;                  /* hash_bytes() of the data. */
+    uint32_t unused[124];
+  };
+
+static struct lock journal_lock;        /* Protects everything below. */
+static struct condition txn_committed;  /* Signaled after each commit. */
+
+/* The running transaction. */
+static disk_sector_t txn[RECORD_MAX];   /* Sectors changed in it. */
+static size_t txn_cnt;
+static size_t handles;                  /* Number of handles open. */
+static size_t credits;                  /* Credits reserved by them. */
+static size_t txn_max;                  /* Most credits, see journal_init(). */
+static size_t group_cnt;                /* Block groups of the free map. */
+
+static uint32_t seq;                    /* Sequence number of the next record. */
+static size_t tail;                     /* Ring slot of the next record. */
+
+/* Sectors committed since the last checkpoint. */
+static disk_sector_t ckpt[RING_SECTORS];
+static size_t ckpt_cnt;
+static bool ckpt_needed;                /* One of them has been freed. */
+
+/* A record being written or replayed. */
+static uint8_t *record;
+#define RECORD_PAGES DIV_ROUND_UP ((RECORD_MAX + 2) * DISK_SECTOR_SIZE, PGSIZE)
+
+static void write_header (void);
+static void commit (void);
+static void checkpoint (void);
+static void ensure_space (void);
+
+/* Initializes the journal module.  The free map must be initialized
+   first. */
+void
+journal_init (void)
+{
+  ASSERT (sizeof (struct journal_header) == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_desc) == DISK_SECTOR_SIZE);
+  ASSERT (sizeof (struct journal_commit) == DISK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&txn_committed);
+  txn_cnt = handles = credits = 0;
+
+  /* held lines cannot be evicted, so leave the cache room for the rest,
+     and leave every block group of the free map room in the record */
+  group_cnt = free_map_group_cnt ();
+  txn_max = buffer_cache_capacity / 4;
+  if (txn_max > TXN_MAX)
+    txn_max = TXN_MAX;
+  if (group_cnt > RECORD_MAX - TXN_MIN)
+    PANIC ("disk too large for the journal");
+  if (txn_max > RECORD_MAX - group_cnt)
+    txn_max = RECORD_MAX - group_cnt;
+  ASSERT (txn_max >= TXN_MIN);
+
+  record = palloc_get_multiple (PAL_ASSERT, RECORD_PAGES);
+}
+
+/* Writes an empty journal to disk.  The old ring is zeroed, so that
+   no record of an earlier file system on the disk is replayed. */
+void
+journal_create (void)
+{
+  const void *buffers[RING_SECTORS];
+  size_t i;
+
+  memset (record, 0, DISK_SECTOR_SIZE);
+  for (i = 0; i < RING_SECTORS; i++)
+    buffers[i] = record;
+  disk_write_multiple (filesys_disk, RING_START, buffers, RING_SECTORS);
+
+  seq = 1;
+  tail = 0;
+  ckpt_cnt = 0;
+  write_header ();
+}
+
+/* Reads the journal and writes back the sectors of every committed
+   record in it, then empties it.  This takes time in proportion to
+   the ring, whatever the size of the disk. */
+void
+journal_open (void)
+{
+  struct journal_header h;
+  struct journal_desc *desc = (struct journal_desc *) record;
+  struct journal_commit *c;
+  uint8_t *data = record + DISK_SECTOR_SIZE;
+  size_t pos, i, replayed = 0;
+
+  disk_read (filesys_disk, JOURNAL_SECTOR, &h);
+  if (h.magic != JOURNAL_MAGIC)
+    PANIC ("journal not found, file system must be formatted");
+
+  seq = h.seq;
+  for (pos = h.head; pos + 2 <= RING_SECTORS; pos += desc->cnt + 2)
+    {
+      disk_read (filesys_disk, RING_START + pos, desc);
+      if (desc->magic != DESC_MAGIC || desc->seq != seq
+          || desc->cnt == 0 || desc->cnt > RECORD_MAX
+          || pos + desc->cnt + 2 > RING_SECTORS)
+        break;
+      for (i = 0; i <= desc->cnt; i++)
+        disk_read (filesys_disk, RING_START + pos + 1 + i,
+                   data + i * DISK_SECTOR_SIZE);
+      c = (struct journal_commit *) (data + desc->cnt * DISK_SECTOR_SIZE);
+      if (c->magic != COMMIT_MAGIC || c->seq != seq || c->cnt != desc->cnt
+          || c->checksum != hash_bytes (data, desc->cnt * DISK_SECTOR_SIZE))
+        break;
+
+      for (i = 0; i < desc->cnt; i++)
+        disk_write (filesys_disk, desc->sectors[i],
+                    data + i * DISK_SECTOR_SIZE);
+      seq++;
+      replayed++;
+    }
+  if (replayed > 0)
+    printf ("journal: replayed %zu transactions.\n", replayed);
+
+  tail = 0;
+  ckpt_cnt = 0;
+  ckpt_needed = false;
+  write_header ();
+}
+
+/* Writes back everything in the journal and empties it. */
+void
+journal_close (void)
+{
+  lock_acquire (&journal_lock);
+  checkpoint ();
+  lock_release (&journal_lock);
+}
+
+/* Opens a handle with CNT credits, that is, room for CNT sectors to be
+   changed through the journal before journal_end().  Waits while the
+   running transaction has fewer credits left.  A handle opened by a
+   thread that has one already nests in it, and its sectors must be
+   covered by the credits of the outer one.
+   Returns false, without a handle, if CNT credits never fit in a
+   transaction, in which case the operation must be rejected or done
+   without the journal. */
+bool
+journal_begin (size_t cnt)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth > 0)
+    {
+      t->journal_depth++;
+      return true;
+    }
+  if (cnt > txn_max)
+    return false;
+
+  lock_acquire (&journal_lock);
+  while (credits + cnt > txn_max)
+    cond_wait (&txn_committed, &journal_lock);
+  if (handles == 0)
+    ensure_space ();
+  handles++;
+  credits += cnt;
+  lock_release (&journal_lock);
+  t->journal_depth = 1;
+  return true;
+}
+
+/* Closes a handle opened by journal_begin().  The last handle of the
+   running transaction commits it. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  ASSERT (handles > 0);
+  if (--handles == 0)
+    {
+      commit ();
+      credits = 0;
+      if (ckpt_needed)
+        checkpoint ();
+      cond_broadcast (&txn_committed, &journal_lock);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Adds SECTOR, which is about to be changed, to the running
+   transaction.  Returns false if the current thread has no handle, in
+   which case the change is not journaled, as while formatting.
+   Panics if the transaction has used up its credits, which means a
+   handle did not reserve enough. */
+bool
+journal_add (disk_sector_t sector)
+{
+  /* the free map is written by the committing thread */
+  bool committing = lock_held_by_current_thread (&journal_lock);
+  size_t i;
+
+  if (!committing && thread_current ()->journal_depth == 0)
+    return false;
+  if (!committing)
+    lock_acquire (&journal_lock);
+  for (i = 0; i < txn_cnt; i++)
+    if (txn[i] == sector)
+      break;
+  if (i == txn_cnt)
+    {
+      if (!committing && txn_cnt >= credits)
+        PANIC ("journal transaction out of credits");
+      ASSERT (txn_cnt < RECORD_MAX);
+      txn[txn_cnt++] = sector;
+    }
+  if (!committing)
+    lock_release (&journal_lock);
+  return true;
+}
+
+/* Notes that CNT sectors from SECTOR have been freed.  If the journal
+   has a copy of one, it is checkpointed when the running transaction
+   commits, or now if none runs, so that the copy is not replayed over
+   whatever the sector holds next.  The running transaction counts as
+   in the journal already. */
+void
+journal_revoke (disk_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < ckpt_cnt && !ckpt_needed; i++)
+    if (ckpt[i] >= sector && ckpt[i] < sector + cnt)
+      ckpt_needed = true;
+  for (i = 0; i < txn_cnt && !ckpt_needed; i++)
+    if (txn[i] >= sector && txn[i] < sector + cnt)
+      ckpt_needed = true;
+  if (ckpt_needed && handles == 0)
+    checkpoint ();
+  lock_release (&journal_lock);
+}
+
+/* Writes the journal header, whose first record is at slot 0. */
+static void
+write_header (void)
+{
+  struct journal_header h;
+
+  memset (&h, 0, sizeof h);
+  h.magic = JOURNAL_MAGIC;
+  h.seq = seq;
+  h.head = 0;
+  disk_write (filesys_disk, JOURNAL_SECTOR, &h);
+}
+
+/* Writes the running transaction, with the changed block groups of
+   the free map, to the ring, and lets its cache lines be written back.
+   journal_lock must be held, and no handle open. */
+static void
+commit (void)
+{
+  static const void *buffers[RECORD_MAX + 2];
+  struct journal_desc *desc = (struct journal_desc *) record;
+  struct journal_commit *c;
+  uint8_t *data = record + DISK_SECTOR_SIZE;
+  size_t i;
+
+  ASSERT (handles == 0);
+  free_map_write ();
+  if (txn_cnt == 0)
+    return;
+  ASSERT (tail + txn_cnt + 2 <= RING_SECTORS);
+
+  memset (desc, 0, sizeof *desc);
+  desc->magic = DESC_MAGIC;
+  desc->seq = seq;
+  desc->cnt = txn_cnt;
+  for (i = 0; i < txn_cnt; i++)
+    {
+      desc->sectors[i] = txn[i];
+      cache_read (txn[i], data + i * DISK_SECTOR_SIZE, 0, DISK_SECTOR_SIZE);
+    }
+  c = (struct journal_commit *) (data + txn_cnt * DISK_SECTOR_SIZE);
+  memset (c, 0, sizeof *c);
+  c->magic = COMMIT_MAGIC;
+  c->seq = seq;
+  c->cnt = txn_cnt;
+  c->checksum = hash_bytes (data, txn_cnt * DISK_SECTOR_SIZE);
+
+  for (i = 0; i < txn_cnt + 2; i++)
+    buffers[i] = record + i * DISK_SECTOR_SIZE;
+  disk_write_multiple (filesys_disk, RING_START + tail, buffers, txn_cnt + 2);
+
+  for (i = 0; i < txn_cnt; i++)
+    {
+      cache_unhold (txn[i]);
+      ckpt[ckpt_cnt++] = txn[i];
+    }
+  tail += txn_cnt + 2;
+  seq++;
+  txn_cnt = 0;
+}
+
+/* Writes the sectors committed since the last checkpoint to their
+   homes, and empties the ring.  Must be called with journal_lock held
+   and no sector in the running transaction. */
+static void
+checkpoint (void)
+{
+  size_t i;
+
+  ASSERT (txn_cnt == 0);
+  for (i = 0; i < ckpt_cnt; i++)
+    cache_flush (ckpt[i]);
+  ckpt_cnt = 0;
+  ckpt_needed = false;
+  tail = 0;
+  write_header ();
+}
+
+/* Makes sure the ring has room for a whole transaction, before the
+   first handle of one opens. */
+static void
+ensure_space (void)
+{
+  if (tail + txn_max + group_cnt + 2 > RING_SECTORS)
+    checkpoint ();
+}
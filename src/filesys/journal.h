@@ -0,0 +1,18 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+bool journal_begin (size_t credits);
+void journal_end (void);
+bool journal_add (disk_sector_t);
+void journal_revoke (disk_sector_t, size_t);
+
+#endif /* filesys/journal.h */
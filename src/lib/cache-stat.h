@@ -0,0 +1,17 @@
+#ifndef __LIB_CACHE_STAT_H
+#define __LIB_CACHE_STAT_H
+
+/* Buffer cache statistics, as returned by the cachestat() system
+   call.  Shared by the kernel and user programs. */
+struct cache_stat
+  {
+    long long hits;                 /* Accesses found in the cache. */
+    long long misses;               /* Accesses that had to add a line. */
+    long long evictions;            /* Lines reused for another sector. */
+    long long write_backs;          /* Dirty sectors written to disk. */
+    long long read_aheads;          /* Sectors read ahead. */
+    long long read_ahead_hits;      /* Read-ahead sectors accessed later. */
+    long long read_ahead_wasted;    /* Read-ahead sectors evicted unused. */
+  };
+
+#endif /* lib/cache-stat.h */
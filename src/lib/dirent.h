@@ -0,0 +1,20 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdbool.h>
+
+/* Longest file name in a directory entry. */
+#define DIRENT_NAME_MAX 14
+
+/* A directory entry with the attributes of its file, as returned
+   by the getdents() system call.  Shared by the kernel and user
+   programs. */
+struct dirent
+  {
+    char name[DIRENT_NAME_MAX + 1]; /* Null terminated file name. */
+    bool is_dir;                    /* Is it a directory? */
+    int inumber;                    /* Inode number. */
+    int length;                     /* Size in bytes. */
+  };
+
+#endif /* lib/dirent.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/* Most buffers in one readv() or writev() call. */
+#define IOV_MAX 64
+
+/* A buffer for the readv() and writev() system calls.  Shared by
+   the kernel and user programs. */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    size_t iov_len;             /* Size of the buffer in bytes. */
+  };
+
+#endif /* lib/iovec.h */
@@ -351,6 +351,34 @@ bitmap_read (struct bitmap *b, struct file *file)
   return success;
 }
 
+/* Reads the bits of B from START through START + CNT - 1 from
+   FILE, where B is stored as by bitmap_write().  Whole elements
+   are read, so the range should be aligned to them.  Returns
+   true if successful, false otherwise. */
+bool
+bitmap_read_range (struct bitmap *b, struct file *file,
+                   size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  if (file_read_at (file, b->bits + first, size, ofs) != size)
+    return false;
+  if (last == elem_cnt (b->bit_cnt) - 1)
+    b->bits[last] &= last_mask (b);
+  return true;
+}
+
 /* Writes B to FILE.  Return true if successful, false
    otherwise. */
 bool
@@ -359,6 +387,29 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B holding bits START through START + CNT - 1
+   to FILE, at the same offset as bitmap_write() would.  Return
+   true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  ofs = first * sizeof (elem_type);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
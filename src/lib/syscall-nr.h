@@ -28,7 +28,15 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_CACHESTAT,              /* Reads buffer cache statistics. */
+    SYS_GETDENTS,               /* Reads directory entries in a batch. */
+    SYS_PREAD,                  /* Reads from a file at an offset. */
+    SYS_PWRITE,                 /* Writes to a file at an offset. */
+    SYS_READV,                  /* Reads from a file into several buffers. */
+    SYS_WRITEV                  /* Writes to a file from several buffers. */
   };
 
 #endif /* lib/syscall-nr.h */
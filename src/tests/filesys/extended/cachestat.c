@@ -0,0 +1,43 @@
+/* Writes a small file, reads it back twice, and checks that
+   cachestat() reports the second pass as cache hits.  The
+   counters must never run backward. */
+
+#include <cache-stat.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2048];
+
+void
+test_main (void) 
+{
+  struct cache_stat st1, st2;
+  int fd;
+  int i;
+
+  memset (buf, 'x', sizeof buf);
+  CHECK (create ("baz", 0), "create \"baz\"");
+  CHECK ((fd = open ("baz")) > 1, "open \"baz\"");
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write 2048 bytes to \"baz\"");
+
+  CHECK (cachestat (&st1), "cachestat");
+  for (i = 0; i < 2; i++)
+    {
+      seek (fd, 0);
+      CHECK (read (fd, buf, sizeof buf) == (int) sizeof buf,
+             "read \"baz\" (pass %d)", i + 1);
+    }
+  CHECK (cachestat (&st2), "cachestat");
+
+  CHECK (st2.hits > st1.hits, "cache hits must grow");
+  CHECK (st2.misses >= st1.misses, "cache misses must not shrink");
+  CHECK (st2.evictions >= st1.evictions && st2.write_backs >= st1.write_backs
+         && st2.read_aheads >= st1.read_aheads,
+         "other counters must not shrink");
+
+  msg ("close \"baz\"");
+  close (fd);
+}
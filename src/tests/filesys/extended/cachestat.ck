@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cachestat) begin
+(cachestat) create "baz"
+(cachestat) open "baz"
+(cachestat) write 2048 bytes to "baz"
+(cachestat) cachestat
+(cachestat) read "baz" (pass 1)
+(cachestat) read "baz" (pass 2)
+(cachestat) cachestat
+(cachestat) cache hits must grow
+(cachestat) cache misses must not shrink
+(cachestat) other counters must not shrink
+(cachestat) close "baz"
+(cachestat) end
+EOF
+pass;
@@ -0,0 +1,54 @@
+/* Lists a directory with getdents(), which must return each entry
+   once, with the inode number, type and size of its file, and then
+   0 at the end of the directory.  A file that is not a directory
+   and a bad file descriptor must be rejected. */
+
+#include <dirent.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct dirent ents[8];
+
+void
+test_main (void) 
+{
+  bool found_b = false, found_c = false;
+  int dir_fd, fd, n, i;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK (create ("a/b", 100), "create \"a/b\"");
+  CHECK (mkdir ("a/c"), "mkdir \"a/c\"");
+  CHECK ((dir_fd = open ("a")) > 1, "open \"a\"");
+  CHECK ((fd = open ("a/b")) > 1, "open \"a/b\"");
+
+  CHECK ((n = getdents (dir_fd, ents, 8)) == 2, "getdents \"a\" (must return 2)");
+  for (i = 0; i < n; i++)
+    if (!strcmp (ents[i].name, "b") && !found_b)
+      {
+        if (ents[i].is_dir || ents[i].length != 100
+            || ents[i].inumber != inumber (fd))
+          fail ("wrong attributes of \"b\"");
+        found_b = true;
+      }
+    else if (!strcmp (ents[i].name, "c") && !found_c)
+      {
+        if (!ents[i].is_dir)
+          fail ("\"c\" must be a directory");
+        found_c = true;
+      }
+    else
+      fail ("unexpected entry \"%s\"", ents[i].name);
+  CHECK (found_b && found_c, "found \"b\" and \"c\"");
+  CHECK (getdents (dir_fd, ents, 8) == 0,
+         "getdents at end of \"a\" (must return 0)");
+
+  CHECK (getdents (fd, ents, 8) == -1, "getdents \"a/b\" (must fail)");
+  CHECK (getdents (dir_fd + 100, ents, 8) == -1, "getdents bad fd (must fail)");
+
+  msg ("close \"a/b\"");
+  close (fd);
+  msg ("close \"a\"");
+  close (dir_fd);
+}
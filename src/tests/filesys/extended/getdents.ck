@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(getdents) begin
+(getdents) mkdir "a"
+(getdents) create "a/b"
+(getdents) mkdir "a/c"
+(getdents) open "a"
+(getdents) open "a/b"
+(getdents) getdents "a" (must return 2)
+(getdents) found "b" and "c"
+(getdents) getdents at end of "a" (must return 0)
+(getdents) getdents "a/b" (must fail)
+(getdents) getdents bad fd (must fail)
+(getdents) close "a/b"
+(getdents) close "a"
+(getdents) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"foobar" => ["\0" x 10 . "abcdefghijklmnopqrstuvwxyz"]});
+pass;
@@ -0,0 +1,54 @@
+/* Writes to a file with pwrite() and reads it back with pread(),
+   neither of which may move the file position.  Offsets whose
+   range ends past the largest file offset, and bad file
+   descriptors, must be rejected. */
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char data[] = "abcdefghijklmnopqrstuvwxyz";
+static const char zeros[10];
+static char buf[26];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (create ("foobar", 0), "create \"foobar\"");
+  CHECK ((fd = open ("foobar")) > 1, "open \"foobar\"");
+
+  CHECK (pwrite (fd, data, 26, 10) == 26, "pwrite 26 bytes at offset 10");
+  CHECK (tell (fd) == 0, "file position must still be 0");
+  CHECK (filesize (fd) == 36, "file size must be 36");
+
+  CHECK (pread (fd, buf, 26, 10) == 26, "pread 26 bytes at offset 10");
+  compare_bytes (buf, data, 26, 10, "foobar");
+  CHECK (pread (fd, buf, 10, 0) == 10, "pread 10 bytes at offset 0");
+  compare_bytes (buf, zeros, 10, 0, "foobar");
+  CHECK (pread (fd, buf, 26, 30) == 6, "pread 26 bytes at offset 30 (must read 6)");
+  CHECK (pread (fd, buf, 26, 36) == 0, "pread at end of file (must read 0)");
+  CHECK (tell (fd) == 0, "file position must still be 0");
+
+  CHECK (pread (fd, buf, 1, 0x80000000u) == -1,
+         "pread at offset 0x80000000 (must fail)");
+  CHECK (pwrite (fd, data, 26, 0x80000000u) == -1,
+         "pwrite at offset 0x80000000 (must fail)");
+  CHECK (pread (fd, buf, 26, INT_MAX - 10) == -1,
+         "pread ending past INT_MAX (must fail)");
+  CHECK (pwrite (fd, data, 26, INT_MAX - 10) == -1,
+         "pwrite ending past INT_MAX (must fail)");
+  CHECK (filesize (fd) == 36, "file size must still be 36");
+
+  CHECK (pread (fd + 100, buf, 26, 0) == -1, "pread bad fd (must fail)");
+  CHECK (pwrite (fd + 100, data, 26, 0) == -1, "pwrite bad fd (must fail)");
+  CHECK (pwrite (STDOUT_FILENO, data, 26, 0) == -1,
+         "pwrite to the console (must fail)");
+
+  msg ("close \"foobar\"");
+  close (fd);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(pread-pwrite) begin
+(pread-pwrite) create "foobar"
+(pread-pwrite) open "foobar"
+(pread-pwrite) pwrite 26 bytes at offset 10
+(pread-pwrite) file position must still be 0
+(pread-pwrite) file size must be 36
+(pread-pwrite) pread 26 bytes at offset 10
+(pread-pwrite) pread 10 bytes at offset 0
+(pread-pwrite) pread 26 bytes at offset 30 (must read 6)
+(pread-pwrite) pread at end of file (must read 0)
+(pread-pwrite) file position must still be 0
+(pread-pwrite) pread at offset 0x80000000 (must fail)
+(pread-pwrite) pwrite at offset 0x80000000 (must fail)
+(pread-pwrite) pread ending past INT_MAX (must fail)
+(pread-pwrite) pwrite ending past INT_MAX (must fail)
+(pread-pwrite) file size must still be 36
+(pread-pwrite) pread bad fd (must fail)
+(pread-pwrite) pwrite bad fd (must fail)
+(pread-pwrite) pwrite to the console (must fail)
+(pread-pwrite) close "foobar"
+(pread-pwrite) end
+EOF
+pass;
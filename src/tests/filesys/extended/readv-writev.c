@@ -0,0 +1,57 @@
+/* Writes a file with writev() and reads it back with readv(),
+   both of which move the file position past the bytes they
+   transfer.  A bad buffer count, a bad file descriptor and a
+   range ending past the largest file offset must be rejected. */
+
+#include <iovec.h>
+#include <limits.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char hello[] = "Hello, ";
+static char world[] = "world";
+static char a[4], b[4], c[8];
+
+void
+test_main (void) 
+{
+  struct iovec out[3] = {{hello, 7}, {world, 0}, {world, 5}};
+  struct iovec in[3] = {{a, 4}, {b, 4}, {c, 8}};
+  int fd;
+
+  CHECK (create ("foobar", 0), "create \"foobar\"");
+  CHECK ((fd = open ("foobar")) > 1, "open \"foobar\"");
+
+  CHECK (writev (fd, out, 3) == 12, "writev 3 buffers of 12 bytes");
+  CHECK (tell (fd) == 12, "file position must be 12");
+
+  msg ("seek \"foobar\" to 0");
+  seek (fd, 0);
+  CHECK (readv (fd, in, 3) == 12, "readv 3 buffers of 16 bytes (must read 12)");
+  compare_bytes (a, "Hell", 4, 0, "foobar");
+  compare_bytes (b, "o, w", 4, 4, "foobar");
+  compare_bytes (c, "orld", 4, 8, "foobar");
+  CHECK (tell (fd) == 12, "file position must be 12");
+  CHECK (readv (fd, in, 3) == 0, "readv at end of file (must read 0)");
+
+  CHECK (readv (fd, in, -1) == -1, "readv -1 buffers (must fail)");
+  CHECK (writev (fd, out, -1) == -1, "writev -1 buffers (must fail)");
+  CHECK (readv (fd, in, IOV_MAX + 1) == -1,
+         "readv IOV_MAX + 1 buffers (must fail)");
+  CHECK (writev (fd, out, IOV_MAX + 1) == -1,
+         "writev IOV_MAX + 1 buffers (must fail)");
+
+  CHECK (readv (fd + 100, in, 3) == -1, "readv bad fd (must fail)");
+  CHECK (writev (fd + 100, out, 3) == -1, "writev bad fd (must fail)");
+
+  msg ("seek \"foobar\" to INT_MAX - 4");
+  seek (fd, INT_MAX - 4);
+  CHECK (writev (fd, out, 3) == -1, "writev ending past INT_MAX (must fail)");
+  CHECK (readv (fd, in, 3) == -1, "readv ending past INT_MAX (must fail)");
+  CHECK (filesize (fd) == 12, "file size must still be 12");
+
+  msg ("close \"foobar\"");
+  close (fd);
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(readv-writev) begin
+(readv-writev) create "foobar"
+(readv-writev) open "foobar"
+(readv-writev) writev 3 buffers of 12 bytes
+(readv-writev) file position must be 12
+(readv-writev) seek "foobar" to 0
+(readv-writev) readv 3 buffers of 16 bytes (must read 12)
+(readv-writev) file position must be 12
+(readv-writev) readv at end of file (must read 0)
+(readv-writev) readv -1 buffers (must fail)
+(readv-writev) writev -1 buffers (must fail)
+(readv-writev) readv IOV_MAX + 1 buffers (must fail)
+(readv-writev) writev IOV_MAX + 1 buffers (must fail)
+(readv-writev) readv bad fd (must fail)
+(readv-writev) writev bad fd (must fail)
+(readv-writev) seek "foobar" to INT_MAX - 4
+(readv-writev) writev ending past INT_MAX (must fail)
+(readv-writev) readv ending past INT_MAX (must fail)
+(readv-writev) file size must still be 12
+(readv-writev) close "foobar"
+(readv-writev) end
+EOF
+pass;
@@ -33,6 +33,7 @@
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/cache.h"
 #endif
 #include "vm/swap.h"
 
@@ -248,6 +249,15 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef FILESYS
+      else if (!strcmp (name, "-bc"))
+        buffer_cache_capacity = atoi (value);
+      else if (!strcmp (name, "-bcp"))
+        {
+          if (value == NULL || !set_buffer_cache_policy (value))
+            PANIC ("unknown buffer cache policy `%s' (use -h for help)", value);
+        }
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -352,6 +362,10 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef FILESYS
+          "  -bc=COUNT          Use COUNT sectors of buffer cache.\n"
+          "  -bcp=POLICY        Use POLICY (2q or clock) to replace buffer cache.\n"
 #endif
           );
   power_off ();
@@ -392,6 +406,7 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
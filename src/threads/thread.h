@@ -126,6 +126,7 @@ struct thread
 
     /* proj4 */
     struct dir * dir; /* current directory */
+    int journal_depth; /* nesting of journal handles, see journal.c */
   };
 
 /* this structure has member e: elements of md_list */
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <syscall-nr.h>
 #include <string.h>
+#include <limits.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -14,6 +15,12 @@
 #include "filesys/file.h"
 #include "filesys/directory.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
+#include <dirent.h>
+#include <iovec.h>
+
+/* most directory entries returned by one getdents() */
+#define GETDENTS_MAX 64
 
 static void syscall_handler (struct intr_frame *);
 void exit(int status);
@@ -112,6 +119,27 @@ void check_valid_buffer (void* buffer, unsigned* size, void* esp, bool to_write)
         exit(-1);
 }
 
+/* checks the IOVCNT buffers of IOV as check_valid_buffer() does, and IOV
+   itself. returns false if IOVCNT is out of range. */
+bool check_valid_iovec(const struct iovec *iov, int iovcnt, void* esp, bool to_write)
+{
+  unsigned size;
+  int i;
+
+  if(iovcnt < 0 || iovcnt > IOV_MAX)
+    return false;
+  if(iovcnt == 0)
+    return true;
+  size = iovcnt * sizeof *iov;
+  check_valid_buffer((void *) iov, &size, esp, false);
+  for(i = 0; i < iovcnt; i++){
+    size = iov[i].iov_len;
+    if(size > 0)
+      check_valid_buffer(iov[i].iov_base, &size, esp, to_write);
+  }
+  return true;
+}
+
 void halt()
 {
   power_off();
@@ -240,6 +268,8 @@ int read(int fd, const void *buffer, unsigned size){
   fd1 = find_fd(&thread_current()->fd_list,fd);
   if(fd1 == NULL)
     return -1;
+  if(inode_is_dir(file_get_inode(fd1->f)))
+    return -1;
   
   return file_read(fd1->f, buffer, size);
 }
@@ -263,6 +293,122 @@ int write(int fd, const void *buffer, unsigned size)
   return file_write(fd1->f,buffer,size);
 }
 
+/* returns the open file of FD, or a null pointer if FD is not open or
+   is a directory */
+static struct file * find_regular_file(int fd){
+  struct fd_elem * fd1 = find_fd(&thread_current()->fd_list, fd);
+
+  if(fd1 == NULL || fd1->f == NULL)
+    return NULL;
+  if(inode_is_dir(file_get_inode(fd1->f)))
+    return NULL;
+  return fd1->f;
+}
+
+/* returns true if SIZE bytes from offset OFS are all within off_t */
+static bool io_range_valid(unsigned ofs, unsigned size){
+  return ofs <= INT_MAX && size <= INT_MAX - ofs;
+}
+
+int pread(int fd, void *buffer, unsigned size, unsigned ofs){
+  struct file * file = find_regular_file(fd);
+
+  if(file == NULL || !io_range_valid(ofs, size))
+    return -1;
+  return file_read_at(file, buffer, size, ofs);
+}
+
+int pwrite(int fd, const void *buffer, unsigned size, unsigned ofs){
+  struct file * file = find_regular_file(fd);
+
+  if(file == NULL || !io_range_valid(ofs, size))
+    return -1;
+  return file_write_at(file, buffer, size, ofs);
+}
+
+/* returns the total length of the IOVCNT buffers of IOV, or -1 if it is
+   more than an int holds */
+static int iov_total(const struct iovec *iov, int iovcnt){
+  unsigned total = 0;
+  int i;
+
+  for(i = 0; i < iovcnt; i++){
+    if(!io_range_valid(total, iov[i].iov_len))
+      return -1;
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+/* reads into the IOVCNT buffers of IOV in turn, from the current position
+   of FD, and advances it past the bytes read. stops at the end of file.
+   returns -1 with nothing read if the buffers would end past the largest
+   file offset. */
+int readv(int fd, const struct iovec *iov, int iovcnt){
+  struct file * file;
+  off_t pos, n;
+  int total = 0, size, i;
+
+  size = iov_total(iov, iovcnt);
+  if(size < 0)
+    return -1;
+
+  if(fd == 0){
+    for(i = 0; i < iovcnt; i++)
+      total += read(fd, iov[i].iov_base, iov[i].iov_len);
+    return total;
+  }
+
+  file = find_regular_file(fd);
+  if(file == NULL)
+    return -1;
+  pos = file_tell(file);
+  if(!io_range_valid(pos, size))
+    return -1;
+  for(i = 0; i < iovcnt; i++){
+    n = file_read_at(file, iov[i].iov_base, iov[i].iov_len, pos + total);
+    total += n;
+    if((size_t) n < iov[i].iov_len)
+      break;
+  }
+  file_seek(file, pos + total);
+  return total;
+}
+
+/* writes the IOVCNT buffers of IOV in turn, from the current position of
+   FD, and advances it past the bytes written. fails like readv() if the
+   buffers would end past the largest file offset. */
+int writev(int fd, const struct iovec *iov, int iovcnt){
+  struct file * file;
+  off_t pos, n;
+  int total = 0, size, i;
+
+  size = iov_total(iov, iovcnt);
+  if(size < 0)
+    return -1;
+
+  if(fd == 1){
+    for(i = 0; i < iovcnt; i++)
+      total += write(fd, iov[i].iov_base, iov[i].iov_len);
+    return total;
+  }
+
+  file = find_regular_file(fd);
+  if(file == NULL)
+    return -1;
+  pos = file_tell(file);
+  if(!io_range_valid(pos, size))
+    return -1;
+  for(i = 0; i < iovcnt; i++){
+    n = file_write_at(file, iov[i].iov_base, iov[i].iov_len, pos + total);
+    total += n;
+    if((size_t) n < iov[i].iov_len)
+      break;
+  }
+  file_seek(file, pos + total);
+  return total;
+}
+
 void seek(int fd, unsigned pos){
   struct fd_elem * fd1;
 
@@ -472,6 +618,21 @@ int inumber(int fd){
   return inode_get_inumber(file_get_inode(find_fd(&curr->fd_list, fd)->f));
 }
 
+int getdents(int fd, struct dirent *ents, unsigned cnt){
+  struct fd_elem * fd1 = find_fd(&thread_current()->fd_list, fd);
+
+  if(fd1 == NULL || fd1->f == NULL)
+    return -1;
+  if(!inode_is_dir(file_get_inode(fd1->f)))
+    return -1;
+  return dir_getdents((struct dir *) fd1->f, ents, cnt);
+}
+
+bool cachestat(struct cache_stat *st){
+  cache_get_stat(st);
+  return true;
+}
+
 void
 syscall_init (void) 
 {
@@ -493,6 +654,12 @@ syscall_handler (struct intr_frame *f UNUSED)
   unsigned initial_size;
   pid_t pid;
   mapid_t mapping;
+  struct cache_stat *st;
+  struct dirent *ents;
+  unsigned ents_size;
+  unsigned ofs;
+  struct iovec *iov;
+  int iovcnt;
   
   if(check_valid_pointer((const void*) f->esp, 4) == 0){
     exit(-1);
@@ -596,6 +763,49 @@ syscall_handler (struct intr_frame *f UNUSED)
         exit(-1);
       break;
 
+    case SYS_PREAD:
+      if(check_valid_pointer((const void*) (f->esp) + 4, 16)){
+        check_valid_buffer((void *) *(char**) (f->esp + 8), (unsigned *) (f->esp + 12), f->esp, true);
+        fd = *((int *)((f->esp) + 4));
+        buffer = *(char**)(f->esp + 8);
+        size = *((unsigned *)((f->esp) + 12));
+        ofs = *((unsigned *)((f->esp) + 16));
+        f->eax = pread(fd, buffer, size, ofs);
+      }
+      else
+        exit(-1);
+      break;
+
+    case SYS_PWRITE:
+      if(check_valid_pointer((const void*) (f->esp) + 4, 16)){
+        check_valid_buffer((void *) *(char**) (f->esp + 8), (unsigned *) (f->esp + 12), f->esp, false);
+        fd = *((int *)((f->esp) + 4));
+        buffer = *(char**)(f->esp + 8);
+        size = *((unsigned *)((f->esp) + 12));
+        ofs = *((unsigned *)((f->esp) + 16));
+        f->eax = pwrite(fd, buffer, size, ofs);
+      }
+      else
+        exit(-1);
+      break;
+
+    case SYS_READV:
+    case SYS_WRITEV:
+      if(check_valid_pointer((const void*) (f->esp) + 4, 12)){
+        fd = *((int *)((f->esp) + 4));
+        iov = *(struct iovec **)(f->esp + 8);
+        iovcnt = *((int *)((f->esp) + 12));
+        if(!check_valid_iovec(iov, iovcnt, f->esp, sys_type == SYS_READV))
+          f->eax = -1;
+        else if(sys_type == SYS_READV)
+          f->eax = readv(fd, iov, iovcnt);
+        else
+          f->eax = writev(fd, iov, iovcnt);
+      }
+      else
+        exit(-1);
+      break;
+
     case SYS_SEEK:
       if(check_valid_pointer((const void*) (f->esp) + 4, 8)){
         fd = *(int *)(f->esp + 4);
@@ -694,6 +904,38 @@ syscall_handler (struct intr_frame *f UNUSED)
         exit(-1);
       break;
 
+    case SYS_CACHESTAT:
+      if(check_valid_pointer((const void*)(f->esp) + 4, 4)){
+        st = *(struct cache_stat **)(f->esp + 4);
+        size = sizeof *st;
+        check_valid_buffer((void *) st, &size, f->esp, true);
+        f->eax = cachestat(st);
+      }
+      else
+        exit(-1);
+      break;
+
+    case SYS_GETDENTS:
+      if(check_valid_pointer((const void*)(f->esp) + 4, 12)){
+        fd = *(int *)(f->esp + 4);
+        ents = *(struct dirent **)(f->esp + 8);
+        size = *(unsigned *)(f->esp + 12);
+        if(size == 0){
+          f->eax = 0;
+          break;
+        }
+        /* at most GETDENTS_MAX records a call, all checked before any is filled */
+        if(size > GETDENTS_MAX)
+          size = GETDENTS_MAX;
+        ents_size = size * sizeof *ents;
+        check_valid_buffer((void *) ents, &ents_size, f->esp, true);
+        f->eax = getdents(fd, ents, size);
+        break;
+      }
+      else
+        exit(-1);
+      break;
+
     default:
       exit(-1);
   }